@@ -10,8 +10,10 @@
 #include "wizchip_conf.h"
 #include "socket.h"
 #include "w5x00_spi.h"
+#include "w5x00_gpio_irq.h"
 #include "w5x00_lwip.h"
 #include "timer.h"
+#include "adc_acquisition.h"
 
 #include "lwip/netif.h"
 #include "lwip/timeouts.h"
@@ -34,6 +36,8 @@
 #include "open62541.h"
 #include "opc_add_temperature.h"
 #include "opc_freertos_status.h"
+#include "opc_adc_acquisition.h"
+#include "opc_model.h"
 
 /**
  * ----------------------------------------------------------------------------------------------------
@@ -56,9 +60,29 @@
 #define OPC_TASK_STACK_SIZE 15*1024
 #define OPC_TASK_PRIORITY 4
 
+#define ADC_TASK_STACK_SIZE 1024
+#define ADC_TASK_PRIORITY 5
+
+/* Core affinity in SMP builds, override at build time */
+#ifndef NETWORK_CORE
+#define NETWORK_CORE 0 // SPI_Task, TCPIP_Task and the async context task
+#endif
+#ifndef APPLICATION_CORE
+#define APPLICATION_CORE 1 // OPC_Task and the sensor tasks
+#endif
+
+/* Sensors, ADC volts to degrees Celsius */
+#define EXT_TEMP_GAIN (1.0f / 0.005f) // (V - 1.25) / 0.005 on input 0
+#define EXT_TEMP_OFFSET (-1.25f / 0.005f)
+#define CHIP_TEMP_GAIN (-1.0f / 0.001721f) // 27 - (V - 0.706) / 0.001721 on input 4
+#define CHIP_TEMP_OFFSET (27.0f + 0.706f / 0.001721f)
+
 /* Buffer */
 #define ETHERNET_BUF_MAX_SIZE (1024 * 2)
 
+/* Interrupt */
+#define WIZ_IRQ_POLL_PERIOD_MS 100 // fallback drain period in case an INTn edge is missed
+
 /* Retry count */
 #define DHCP_RETRY_COUNT 5
 #define DNS_RETRY_COUNT 5
@@ -80,13 +104,17 @@ async_context_t asyncContext;
 static volatile uint32_t g_msec_cnt = 0;
 static datetime_t system_time = {};
 
+/* OPC UA server, changed under g_opc_lock so that other tasks can stop it. The lock is also
+ * held while the server is woken, so it is not deleted in the meantime. */
+static SemaphoreHandle_t g_opc_lock = NULL;
+static volatile UA_Boolean g_opc_running = false;
+static UA_Boolean g_opc_stopped = false; // the lease was lost, do not start until it is back
+static UA_Server *g_opc_server = NULL;
+
 /* FreeRTOS Tasks' handles */
 TaskHandle_t spi_handle_t = NULL;
 TaskHandle_t opc_handle_t = NULL;
-TaskHandle_t temp_sensor_handle_t = NULL;
-
-/* Temperature sensor */
-float g_current_temperature = 0.0f;
+TaskHandle_t adc_handle_t = NULL;
 
 /**
  * ----------------------------------------------------------------------------------------------------
@@ -99,14 +127,18 @@ static void set_clock_khz(void);
 /* FreeRTOS Tasks */
 static void spi_task(void *argument);
 static void opc_task(void *argument);
-static void temperature_task(void *argument);
+
+/* Interrupt */
+static void wizchip_gpio_irq_callback(void);
 
 /* Other */
+static void set_task_core(TaskHandle_t xTask, UBaseType_t uxCore);
 static void netif_config(void);
+static void opc_netif_status_callback(struct netif *netif);
+static void opc_server_stop(void);
 static void s_command_handler(const TaskHandle_t xTask);
 void set_system_time(uint32_t s);
 uint32_t get_system_time(void);
-float read_temperature();
 
 /**
  * ----------------------------------------------------------------------------------------------------
@@ -132,19 +164,34 @@ int main()
     wizchip_initialize();
     wizchip_check();
 
+    printf("[WIZ]\t\tSPI clock %lu Hz\n", wizchip_spi_probe_baudrate());
+#ifdef WIZCHIP_SPI_BENCHMARK
+    wizchip_spi_benchmark();
+#endif
+
     // Initialize LWIP task in NO_SYS=0 mode
+#if configUSE_CORE_AFFINITY && (configNUM_CORES > 1)
+    async_context_freertos_config_t asyncContextConfig = async_context_freertos_default_config();
+    asyncContextConfig.task_core_id = NETWORK_CORE;
+    async_context_freertos_init(&asyncContextFreertos, &asyncContextConfig);
+#else
     async_context_freertos_init_with_defaults(&asyncContextFreertos);
+#endif
     lwip_freertos_init(&asyncContextFreertos.core);
+    set_task_core(xTaskGetHandle(TCPIP_THREAD_NAME), NETWORK_CORE);
+
+    // The status callback stops the OPC UA server, the lock must exist before the netif is up
+    g_opc_lock = xSemaphoreCreateMutex();
     netif_config();
 
     // Initialize Real Time Clock
     rtc_init();
 
-    // Initialize ADC and Temperature sensor
+    // Initialize ADC, ADC_Task runs the conversions
     adc_init();
-    adc_set_temp_sensor_enabled(true);
-    adc_select_input(0);
-    
+    adc_acquisition_set_conversion(0, EXT_TEMP_GAIN, EXT_TEMP_OFFSET);
+    adc_acquisition_set_conversion(ADC_ACQ_TEMP_SENSOR_INPUT, CHIP_TEMP_GAIN, CHIP_TEMP_OFFSET);
+
     // Initialize LED
     gpio_init(25);
     gpio_set_dir(25, GPIO_OUT);
@@ -157,11 +204,15 @@ int main()
     {
         printf("[OPC UA]\tError creating task - couldn't allocate required memory\n");
     }
-    if (pdPASS != xTaskCreate(temperature_task, "TEMP_Task", 2048, NULL, 5, &temp_sensor_handle_t))
+    if (pdPASS != xTaskCreate(adc_acquisition_task, "ADC_Task", ADC_TASK_STACK_SIZE, NULL, ADC_TASK_PRIORITY, &adc_handle_t))
     {
-        printf("[TEMPERATURE]\tError creating task - couldn't allocate required memory\n");
+        printf("[ADC]\t\tError creating task - couldn't allocate required memory\n");
     }
 
+    set_task_core(spi_handle_t, NETWORK_CORE);
+    set_task_core(opc_handle_t, APPLICATION_CORE);
+    set_task_core(adc_handle_t, APPLICATION_CORE);
+
     vTaskStartScheduler();
 
     while (1)
@@ -175,6 +226,16 @@ int main()
  * Functions
  * ----------------------------------------------------------------------------------------------------
  */
+static void set_task_core(TaskHandle_t xTask, UBaseType_t uxCore)
+{
+#if configUSE_CORE_AFFINITY && (configNUM_CORES > 1)
+    if (xTask != NULL)
+    {
+        vTaskCoreAffinitySet(xTask, 1u << uxCore);
+    }
+#endif
+}
+
 static void netif_config(void)
 {
     int8_t retval = 0;
@@ -189,7 +250,7 @@ static void netif_config(void)
 
     // Assign callbacks for link and status
     netif_set_link_callback(&g_netif, netif_link_callback);
-    netif_set_status_callback(&g_netif, netif_status_callback);
+    netif_set_status_callback(&g_netif, opc_netif_status_callback);
 
     // MACRAW socket open
     retval = socket(SOCKET_MACRAW, Sn_MR_MACRAW, PORT_LWIPERF, 0x00);
@@ -207,6 +268,40 @@ static void netif_config(void)
     dhcp_start(&g_netif);
 }
 
+/* The server is bound to the address it was started with, stop it once the lease is lost.
+ * OPC_Task builds a new one when an address is assigned again. */
+static void opc_netif_status_callback(struct netif *netif)
+{
+    netif_status_callback(netif);
+
+    if (ip4_addr_isany_val(*netif_ip4_addr(netif)))
+    {
+        opc_server_stop();
+    }
+    else
+    {
+        xSemaphoreTake(g_opc_lock, portMAX_DELAY);
+        g_opc_stopped = false;
+        xSemaphoreGive(g_opc_lock);
+    }
+}
+
+static void opc_server_stop(void)
+{
+    // Not a critical section, waking the server is a FreeRTOS call that may yield
+    xSemaphoreTake(g_opc_lock, portMAX_DELAY);
+    g_opc_stopped = true;
+    g_opc_running = false;
+#ifdef UA_ENABLE_SERVER_WAKEUP
+    // Leave the loop now instead of after its timeout
+    if (g_opc_server != NULL)
+    {
+        UA_Server_wakeup(g_opc_server);
+    }
+#endif
+    xSemaphoreGive(g_opc_lock);
+}
+
 /* Clock */
 static void set_clock_khz(void)
 {
@@ -223,6 +318,20 @@ static void set_clock_khz(void)
     );
 }
 
+/* Interrupt */
+static void wizchip_gpio_irq_callback(void)
+{
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+    // Runs in the GPIO ISR: no SPI access here, just wake the receive task
+    if (spi_handle_t != NULL)
+    {
+        vTaskNotifyGiveFromISR(spi_handle_t, &xHigherPriorityTaskWoken);
+    }
+
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
 void vApplicationMallocFailedHook()
 {
     for (;;)
@@ -309,24 +418,6 @@ uint32_t get_system_time(void)
     return seconds;
 }
 
-float read_temperature()
-{
-    uint16_t raw = adc_read();
-    const float conversion_factor = 3.3f / (4096 - 1);
-    float result = raw * conversion_factor;
-    if (adc_get_selected_input() == 4)
-    {
-        
-        float temp = 27 - (result - 0.706)/0.001721;
-        return temp;
-    }
-    else
-    {
-        float temp = (result - 1.25)/0.005;
-        return temp;
-    }
-}
-
 static void s_command_handler(const TaskHandle_t xTask)
 {
     // Show the size of the free heap.
@@ -367,34 +458,28 @@ static void s_command_handler(const TaskHandle_t xTask)
  * FreeRTOS Task Functions
  * ----------------------------------------------------------------------------------------------------
  */
-void spi_task(void *argument)
+static void spi_task(void *argument)
 {
-    uint16_t pack_len = 0;
     struct pbuf *p = NULL;
-    uint8_t *pack = malloc(ETHERNET_MTU);
+
+    wizchip_gpio_interrupt_initialize(SOCKET_MACRAW, wizchip_gpio_irq_callback);
 
     while (1)
     {
-        getsockopt(SOCKET_MACRAW, SO_RECVBUF, &pack_len);
+        // Sleep until INTn reports a received or sent frame
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(WIZ_IRQ_POLL_PERIOD_MS));
 
-        if (pack_len > 0)
-        {
-            pack_len = recv_lwip(SOCKET_MACRAW, (uint8_t *)pack, pack_len);
+        // Retire the frame on the wire and start the next queued one
+        send_lwip_poll(SOCKET_MACRAW);
 
-            if (pack_len)
-            {
-                p = pbuf_alloc(PBUF_RAW, pack_len, PBUF_POOL);
-                pbuf_take(p, pack, pack_len);
-                free(pack);
+        // Acknowledge RECV before draining, so a frame arriving meanwhile asserts INTn again
+        setSn_IR(SOCKET_MACRAW, Sn_IR_RECV);
 
-                pack = malloc(ETHERNET_MTU);
-            }
-            else
-            {
-                printf("[WIZ]\t\tNo packet received\n");
-            }
+        while (getSn_RX_RSR(SOCKET_MACRAW) > 0)
+        {
+            p = recv_lwip_pbuf(SOCKET_MACRAW);
 
-            if (pack_len && p != NULL)
+            if (p != NULL)
             {
                 LINK_STATS_INC(link.recv);
 
@@ -407,69 +492,88 @@ void spi_task(void *argument)
     }
 }
 
-void opc_task(void *argument)
+static void opc_task(void *argument)
 {
-    UA_Boolean running = true;
     UA_StatusCode retval;
+    UA_Boolean sntp_started = false;
     // Allows to set smaller buffer for the connections, which can cause problems
     UA_UInt32 sendBufferSize = 16000;
     UA_UInt32 recvBufferSize = 16000;
     UA_UInt16 portNumber = 4840;
 
-    // Start DHCP configuration for an interface
-    while ((g_netif.ip_addr.addr == 0) && (g_netif.netmask.addr == 0))
-    {
-        vTaskDelay(1000);
-    }
-    sntp_init();
-    while (get_system_time() <= 1704056400) //Sun Dec 31 2023 21:00:00 GMT+0000
+    // One server per DHCP lease
+    while (1)
     {
-        vTaskDelay(1000);
-    }
+        // Start DHCP configuration for an interface
+        while ((g_netif.ip_addr.addr == 0) && (g_netif.netmask.addr == 0))
+        {
+            vTaskDelay(1000);
+        }
+        if (!sntp_started)
+        {
+            sntp_init();
+            sntp_started = true;
+        }
+        while (get_system_time() <= 1704056400) //Sun Dec 31 2023 21:00:00 GMT+0000
+        {
+            vTaskDelay(1000);
+        }
 
-    UA_Server *server = UA_Server_new();
-    UA_ServerConfig *config = UA_Server_getConfig(server);
-    retval = UA_ServerConfig_setMinimalCustomBuffer(config, portNumber, 0, sendBufferSize, recvBufferSize);
-    if (retval != UA_STATUSCODE_GOOD)
-    {
-        UA_LOG_ERROR(UA_Log_Stdout, UA_LOGCATEGORY_SERVER, "tUA_ServerConfig_setMinimalCustomBuffer() Status: 0x%x (%s)\n", retval, UA_StatusCode_name(retval));
-    }
+        UA_Server *server = UA_Server_new();
+        UA_ServerConfig *config = UA_Server_getConfig(server);
+        retval = UA_ServerConfig_setMinimalCustomBuffer(config, portNumber, 0, sendBufferSize, recvBufferSize);
+        if (retval != UA_STATUSCODE_GOOD)
+        {
+            UA_LOG_ERROR(UA_Log_Stdout, UA_LOGCATEGORY_SERVER, "tUA_ServerConfig_setMinimalCustomBuffer() Status: 0x%x (%s)\n", retval, UA_StatusCode_name(retval));
+        }
 
-    UA_String UA_hostname = UA_STRING(ip4addr_ntoa(netif_ip4_addr(&g_netif)));
+        UA_String UA_hostname = UA_STRING(ip4addr_ntoa(netif_ip4_addr(&g_netif)));
 
-    UA_String_clear(&config->customHostname);
-    UA_String_copy(&UA_hostname, &config->customHostname);
+        UA_String_clear(&config->customHostname);
+        UA_String_copy(&UA_hostname, &config->customHostname);
 
-    s_command_handler(opc_handle_t);
+        s_command_handler(opc_handle_t);
 
-    // add a variable node to the adresspace
-    addTempVariable(server);
-    addGetHeapStatsVariable(server);
-    addTaskStatsFolder(server);
-    // addTaskStatsVariable(server, opc_handle_t);
-    // addTaskStatsVariable(server, spi_handle_t);
-    // addTaskStatsVariable(server, temp_sensor_handle_t);
-    // addTaskStatsVariable(server, xTaskGetHandle("TCPIP_Task"));
+        // add the information model to the adresspace, a node that fails is left out
+        size_t failed = loadOpcModel(server);
+        if (failed > 0)
+        {
+            UA_LOG_ERROR(UA_Log_Stdout, UA_LOGCATEGORY_SERVER, "loadOpcModel() %u of %u nodes failed\n",
+                         (unsigned int)failed, (unsigned int)OPC_MODEL_NODE_COUNT);
+        }
+        startHeapStatsRefresh(server);
+        startTaskStatsRefresh(server);
 
-    retval = UA_Server_run(server, &running);
-    if (retval != UA_STATUSCODE_GOOD)
-    {
-        UA_LOG_FATAL(UA_Log_Stdout, UA_LOGCATEGORY_SERVER, "UA_Server_run() Status: 0x%x (%s)\n", retval, UA_StatusCode_name(retval));
-    }
-    UA_Server_delete(server);
-    UA_ServerConfig_clean(config);
-}
+        // A lease lost since the address was read must not be overridden
+        UA_Boolean started = false;
+        xSemaphoreTake(g_opc_lock, portMAX_DELAY);
+        if (!g_opc_stopped)
+        {
+            g_opc_server = server;
+            g_opc_running = true;
+            started = true;
+        }
+        xSemaphoreGive(g_opc_lock);
 
-void temperature_task(void *argument)
-{
-    TickType_t xLastWakeTime;
-    xLastWakeTime = xTaskGetTickCount();
+        if (started)
+        {
+            retval = UA_Server_run(server, &g_opc_running);
+            if (retval != UA_STATUSCODE_GOOD)
+            {
+                UA_LOG_FATAL(UA_Log_Stdout, UA_LOGCATEGORY_SERVER, "UA_Server_run() Status: 0x%x (%s)\n", retval, UA_StatusCode_name(retval));
+            }
+        }
 
-    while(1)
-    {
-        float temp = read_temperature();
-        g_current_temperature = temp;
+        // Nothing may wake the server once it is deleted, wait for a wakeup in progress
+        xSemaphoreTake(g_opc_lock, portMAX_DELAY);
+        g_opc_server = NULL;
+        xSemaphoreGive(g_opc_lock);
+        stopAdcExternalValues();
+
+        // Also cleans the config, which lives inside the server
+        UA_Server_delete(server);
 
-        vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(1000));
+        // Do not spin if the server failed with an address still assigned
+        vTaskDelay(1000);
     }
-}
\ No newline at end of file
+}
@@ -15,7 +15,7 @@
 #define configTICK_RATE_HZ                      ( ( TickType_t ) 1000 )
 #define configMAX_PRIORITIES                    10
 #define configMINIMAL_STACK_SIZE                ( configSTACK_DEPTH_TYPE ) 256
-#define configTOTAL_HEAP_SIZE                   (100 * 1024)
+#define configTOTAL_HEAP_SIZE                   (140 * 1024)
 #define configMAX_TASK_NAME_LEN                 32
 #define configUSE_16_BIT_TICKS                  0
 #define configIDLE_SHOULD_YIELD                 1
@@ -36,10 +36,17 @@
 #define configMESSAGE_BUFFER_LENGTH_TYPE        size_t
 
 /* SMP port only */
+#ifdef FREERTOS_SMP
+#define configNUM_CORES                         2
+#define configTICK_CORE                         0
+#define configRUN_MULTIPLE_PRIORITIES           1
+#define configUSE_CORE_AFFINITY                 1
+#else
 #define configNUM_CORES                         1
 #define configTICK_CORE                         0
 #define configRUN_MULTIPLE_PRIORITIES           0
 #define configUSE_CORE_AFFINITY                 0
+#endif
 
 /* RP2040 specific */
 #define configSUPPORT_PICO_SYNC_INTEROP         1
@@ -111,10 +118,13 @@ extern uint64_t                                 time_us_64(void);
 #define RUN_TIME_STAT_time_us_64Divider         1000			                                // stat granularity is mS
 #define portGET_RUN_TIME_COUNTER_VALUE()        (time_us_64()/RUN_TIME_STAT_time_us_64Divider)	// runtime counter in mS     /* Define this to sample the timer/counter */
 
+/* The RP2040 port used for SMP provides these itself */
+#ifndef FREERTOS_SMP
 #define portGET_CORE_ID()                       get_core_num()
 #define portCHECK_IF_IN_ISR()                   ({ \
                                                 uint32_t ulIPSR; \
                                                 __asm volatile ("mrs %0, IPSR" : "=r" (ulIPSR)::); \
                                                 ((uint8_t)ulIPSR)>0;})
+#endif
 
 #endif /* FREERTOS_CONFIG_H */
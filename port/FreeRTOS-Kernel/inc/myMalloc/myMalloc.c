@@ -3,6 +3,27 @@
 #include "string.h"
 #include <stdio.h>
 
+/* Mirrors the header heap_4.c keeps in front of every block. The block size
+ * includes the header; its top bit marks the block as allocated. */
+typedef struct HeapBlockLink
+{
+    struct HeapBlockLink *pxNextFreeBlock;
+    size_t xBlockSize;
+} HeapBlockLink_t;
+
+#define HEAP_STRUCT_SIZE ((sizeof(HeapBlockLink_t) + (portBYTE_ALIGNMENT - 1)) & ~((size_t)portBYTE_ALIGNMENT_MASK))
+#define HEAP_BLOCK_ALLOCATED_BIT ((size_t)1 << ((sizeof(size_t) * 8) - 1))
+
+static ReallocStats_t xReallocStats = {0};
+
+/* Number of bytes the caller may use in a block returned by pvPortMalloc */
+static size_t prvHeapBlockUsableSize(void *mem)
+{
+    HeapBlockLink_t *pxLink = (HeapBlockLink_t *)((uint8_t *)mem - HEAP_STRUCT_SIZE);
+    configASSERT((pxLink->xBlockSize & HEAP_BLOCK_ALLOCATED_BIT) != 0);
+    return (pxLink->xBlockSize & ~HEAP_BLOCK_ALLOCATED_BIT) - HEAP_STRUCT_SIZE;
+}
+
 void *pvPortRealloc(void *mem, size_t size)
 {
     if (size == 0)
@@ -16,27 +37,33 @@ void *pvPortRealloc(void *mem, size_t size)
         return pvPortCalloc(1, size);
     }
 
-    void *rc;
-    /* allocate 'count' objects of size 'size' */
+    /* Keep the block while it is large enough and shrinking would not give a
+     * worthwhile part back to the heap */
+    size_t oldsize = prvHeapBlockUsableSize(mem);
+    if (size <= oldsize && oldsize - size < REALLOC_SHRINK_MIN_BYTES)
     {
-        rc = pvPortMalloc(size);
-        if (rc == NULL)
-        {
-            printf("malloc return NULL!\n");
-        }
+        vTaskSuspendAll();
+        xReallocStats.ulInPlace++;
+        xTaskResumeAll();
+        return mem;
     }
-    vTaskSuspendAll();
-    if (rc)
+
+    void *rc = pvPortMalloc(size);
+    if (rc == NULL)
     {
-        /* zero the memory */
-        if (mem != NULL)
-        {
-            memcpy(rc, mem, size);
-            vPortFree(mem);
-        }
+        printf("malloc return NULL!\n");
+        return NULL;
     }
+
+    size_t copysize = (size < oldsize) ? size : oldsize;
+    memcpy(rc, mem, copysize);
+    vPortFree(mem);
+
+    vTaskSuspendAll();
+    xReallocStats.ulMoved++;
+    xReallocStats.ulBytesCopied += copysize;
 #if PICO_DEBUG_MALLOC
-    if (!rc || ((uint8_t *)rc) + size > (uint8_t*)PICO_DEBUG_MALLOC_LOW_WATER) {
+    if (((uint8_t *)rc) + size > (uint8_t*)PICO_DEBUG_MALLOC_LOW_WATER) {
         printf("realloc %p %d->%p\n", mem, (unsigned int) size, rc);
     }
 #endif
@@ -44,13 +71,20 @@ void *pvPortRealloc(void *mem, size_t size)
     return rc;
 }
 
+void vPortGetReallocStats(ReallocStats_t *pxReallocStats)
+{
+    vTaskSuspendAll();
+    *pxReallocStats = xReallocStats;
+    xTaskResumeAll();
+}
+
 void *pvPortCalloc(size_t count, size_t size)
 {
     void *rc;
 
     /* allocate 'count' objects of size 'size' */
     {
-        void *rc = pvPortMalloc(count * size);
+        rc = pvPortMalloc(count * size);
         if (rc == NULL)
         {
             printf("malloc return NULL!\n");
@@ -68,4 +102,193 @@ void *pvPortCalloc(size_t count, size_t size)
 #endif
     xTaskResumeAll();
     return rc;
-}
\ No newline at end of file
+}
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Slab pools
+ * ----------------------------------------------------------------------------------------------------
+ */
+typedef struct SlabBlock
+{
+    struct SlabBlock *pxNext;
+} SlabBlock_t;
+
+typedef struct
+{
+    uint8_t *pucStart;
+    uint8_t *pucEnd;
+    uint8_t *pucNext;        // first block never handed out
+    SlabBlock_t *pxFreeList; // blocks returned by vSlabFree
+    SlabStats_t xStats;
+} SlabClass_t;
+
+static uint8_t ucSlab16[16 * SLAB_BLOCKS_16] __attribute__((aligned(8)));
+static uint8_t ucSlab32[32 * SLAB_BLOCKS_32] __attribute__((aligned(8)));
+static uint8_t ucSlab64[64 * SLAB_BLOCKS_64] __attribute__((aligned(8)));
+static uint8_t ucSlab128[128 * SLAB_BLOCKS_128] __attribute__((aligned(8)));
+static uint8_t ucSlab256[256 * SLAB_BLOCKS_256] __attribute__((aligned(8)));
+
+#define SLAB_CLASS(arena, size, count) \
+    {arena, arena + sizeof(arena), arena, NULL, {size, count, 0, 0, 0, 0}}
+
+static SlabClass_t xSlabClasses[SLAB_CLASS_COUNT] = {
+    SLAB_CLASS(ucSlab16, 16, SLAB_BLOCKS_16),
+    SLAB_CLASS(ucSlab32, 32, SLAB_BLOCKS_32),
+    SLAB_CLASS(ucSlab64, 64, SLAB_BLOCKS_64),
+    SLAB_CLASS(ucSlab128, 128, SLAB_BLOCKS_128),
+    SLAB_CLASS(ucSlab256, 256, SLAB_BLOCKS_256),
+};
+
+static SlabClass_t *prvSlabClassForSize(size_t size)
+{
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++)
+    {
+        if (size <= xSlabClasses[i].xStats.xBlockSize)
+        {
+            return &xSlabClasses[i];
+        }
+    }
+    return NULL;
+}
+
+static SlabClass_t *prvSlabClassForPointer(const void *mem)
+{
+    const uint8_t *puc = (const uint8_t *)mem;
+
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++)
+    {
+        if (puc >= xSlabClasses[i].pucStart && puc < xSlabClasses[i].pucEnd)
+        {
+            return &xSlabClasses[i];
+        }
+    }
+    return NULL;
+}
+
+void *pvSlabMalloc(size_t size)
+{
+    SlabClass_t *pxClass = prvSlabClassForSize(size);
+    void *rc = NULL;
+
+    if (pxClass == NULL)
+    {
+        return pvPortMalloc(size);
+    }
+
+    vTaskSuspendAll();
+    if (pxClass->pxFreeList != NULL)
+    {
+        rc = pxClass->pxFreeList;
+        pxClass->pxFreeList = pxClass->pxFreeList->pxNext;
+    }
+    else if (pxClass->pucNext < pxClass->pucEnd)
+    {
+        rc = pxClass->pucNext;
+        pxClass->pucNext += pxClass->xStats.xBlockSize;
+    }
+
+    if (rc != NULL)
+    {
+        pxClass->xStats.ulHits++;
+        pxClass->xStats.xBlocksInUse++;
+        if (pxClass->xStats.xBlocksInUse > pxClass->xStats.xHighWater)
+        {
+            pxClass->xStats.xHighWater = pxClass->xStats.xBlocksInUse;
+        }
+    }
+    else
+    {
+        pxClass->xStats.ulMisses++;
+    }
+    xTaskResumeAll();
+
+    /* The class is exhausted, fall through to the heap */
+    if (rc == NULL)
+    {
+        rc = pvPortMalloc(size);
+    }
+    return rc;
+}
+
+void *pvSlabCalloc(size_t count, size_t size)
+{
+    if (size != 0 && count > ((size_t)-1) / size)
+    {
+        return NULL;
+    }
+
+    void *rc = pvSlabMalloc(count * size);
+    if (rc != NULL)
+    {
+        memset(rc, 0, count * size);
+    }
+    return rc;
+}
+
+void vSlabFree(void *mem)
+{
+    if (mem == NULL)
+    {
+        return;
+    }
+
+    SlabClass_t *pxClass = prvSlabClassForPointer(mem);
+    if (pxClass == NULL)
+    {
+        vPortFree(mem);
+        return;
+    }
+
+    vTaskSuspendAll();
+    SlabBlock_t *pxBlock = (SlabBlock_t *)mem;
+    pxBlock->pxNext = pxClass->pxFreeList;
+    pxClass->pxFreeList = pxBlock;
+    pxClass->xStats.xBlocksInUse--;
+    xTaskResumeAll();
+}
+
+void *pvSlabRealloc(void *mem, size_t size)
+{
+    if (mem == NULL)
+    {
+        return pvSlabMalloc(size);
+    }
+
+    if (size == 0)
+    {
+        vSlabFree(mem);
+        return NULL;
+    }
+
+    SlabClass_t *pxClass = prvSlabClassForPointer(mem);
+    if (pxClass == NULL)
+    {
+        return pvPortRealloc(mem, size);
+    }
+
+    /* Still fits into its block */
+    size_t oldsize = pxClass->xStats.xBlockSize;
+    if (size <= oldsize)
+    {
+        return mem;
+    }
+
+    void *rc = pvSlabMalloc(size);
+    if (rc != NULL)
+    {
+        memcpy(rc, mem, oldsize);
+        vSlabFree(mem);
+    }
+    return rc;
+}
+
+void vPortGetSlabStats(SlabStats_t *pxSlabStats)
+{
+    vTaskSuspendAll();
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++)
+    {
+        pxSlabStats[i] = xSlabClasses[i].xStats;
+    }
+    xTaskResumeAll();
+}
@@ -1,8 +1,60 @@
 #ifndef MY_MALLOC_H
+#define MY_MALLOC_H
 
 #include <FreeRTOS.h>
 
+/* Slab pools for small blocks in front of pvPortMalloc. Each size class has a
+ * static arena of fixed-size blocks; requests larger than the biggest class,
+ * or arriving while their class is exhausted, fall through to the heap. */
+#define SLAB_CLASS_COUNT 5
+
+#ifndef SLAB_BLOCKS_16
+#define SLAB_BLOCKS_16 128
+#endif
+#ifndef SLAB_BLOCKS_32
+#define SLAB_BLOCKS_32 128
+#endif
+#ifndef SLAB_BLOCKS_64
+#define SLAB_BLOCKS_64 64
+#endif
+#ifndef SLAB_BLOCKS_128
+#define SLAB_BLOCKS_128 32
+#endif
+#ifndef SLAB_BLOCKS_256
+#define SLAB_BLOCKS_256 16
+#endif
+
+typedef struct
+{
+    size_t xBlockSize;
+    size_t xBlockCount;
+    size_t xBlocksInUse;
+    size_t xHighWater;   // most blocks ever in use at once
+    uint32_t ulHits;     // allocations served by the class
+    uint32_t ulMisses;   // allocations that fell through to the heap
+} SlabStats_t;
+
+/* pvPortRealloc keeps a block that is large enough unless shrinking would
+ * return at least this many bytes to the heap */
+#ifndef REALLOC_SHRINK_MIN_BYTES
+#define REALLOC_SHRINK_MIN_BYTES 64
+#endif
+
+typedef struct
+{
+    uint32_t ulInPlace;     // reallocations that kept their block
+    uint32_t ulMoved;       // reallocations that moved to a new block
+    uint32_t ulBytesCopied; // bytes copied by moved reallocations
+} ReallocStats_t;
+
 void *pvPortRealloc(void *mem, size_t newsize);
 void *pvPortCalloc(size_t count, size_t size);
 
-#endif //MY_MALLOC_H
\ No newline at end of file
+void *pvSlabMalloc(size_t size);
+void *pvSlabCalloc(size_t count, size_t size);
+void *pvSlabRealloc(void *mem, size_t size);
+void vSlabFree(void *mem);
+void vPortGetSlabStats(SlabStats_t *pxSlabStats);
+void vPortGetReallocStats(ReallocStats_t *pxReallocStats);
+
+#endif //MY_MALLOC_H
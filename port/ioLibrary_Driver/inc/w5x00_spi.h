@@ -21,8 +21,39 @@
 #define PIN_CS 5
 #define PIN_RST 20
 
+/* SPI clock */
+#define WIZCHIP_SPI_BAUDRATE_DEFAULT (5000 * 1000) // boot clock, before wizchip_spi_probe_baudrate()
+#define WIZCHIP_SPI_PROBE_READS 256                // consecutive good VERSIONR reads to accept a clock
+#define WIZCHIP_SPI_PROBE_BURST_LEN 512            // bytes written and read back through the socket 0 TX buffer
+#define WIZCHIP_SPI_PROBE_BURSTS 8                 // burst round trips, each with a different pattern
+
+/* Chip version */
+#if (_WIZCHIP_ == W5100S)
+#define WIZCHIP_VERSION 0x51
+#elif (_WIZCHIP_ == W5500)
+#define WIZCHIP_VERSION 0x04
+#endif
+
 /* Use SPI DMA */
-//#define USE_SPI_DMA // if you want to use SPI DMA, uncomment.
+#define USE_SPI_DMA // if you don't want to use SPI DMA, comment out.
+#define WIZCHIP_SPI_DMA_MIN_LEN 8          // shorter bursts use blocking transfers
+#define WIZCHIP_SPI_DMA_ASYNC_MIN_LEN 256  // shorter DMA bursts spin instead of sleeping on the DMA interrupt
+#define WIZCHIP_DMA_NOTIFY_INDEX 2         // task notification index used to signal DMA completion
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Variables
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* DMA statistics */
+typedef struct
+{
+    uint32_t sync_transfers;  // DMA bursts that spun until completion
+    uint32_t async_transfers; // DMA bursts that slept until the completion interrupt
+    uint64_t sync_bytes;
+    uint64_t async_bytes;
+    uint64_t async_wait_us;   // time the CPU was free for other tasks during asynchronous bursts
+} wizchip_dma_stats_t;
 
 /**
  * ----------------------------------------------------------------------------------------------------
@@ -71,6 +102,16 @@ static uint8_t wizchip_read(void);
 static void wizchip_write(uint8_t tx_data);
 
 #ifdef USE_SPI_DMA
+/*! \brief Get DMA statistics
+ *  \ingroup w5x00_spi
+ *
+ *  Copy the synchronous and asynchronous DMA transfer counters.
+ *  CPU time reclaimed per MB is async_wait_us * 1000000 / async_bytes.
+ *
+ *  \param stats a pointer to the structure to fill
+ */
+void wizchip_dma_get_stats(wizchip_dma_stats_t *stats);
+
 /*! \brief Configure all DMA parameters and optionally start transfer
  *  \ingroup w5x00_spi
  *
@@ -84,7 +125,9 @@ static void wizchip_read_burst(uint8_t *pBuf, uint16_t len);
 /*! \brief Configure all DMA parameters and optionally start transfer
  *  \ingroup w5x00_spi
  *
- *  Configure all DMA parameters and write to DMA
+ *  Configure all DMA parameters and write to DMA.
+ *  A 3 byte write with no header pending is the address/control phase and is
+ *  held back until the following data phase.
  *
  *  \param pBuf Buffer of data to write
  *  \param len element count (each element is of size transfer_data_size)
@@ -96,8 +139,8 @@ static void wizchip_write_burst(uint8_t *pBuf, uint16_t len);
  *  \ingroup w5x00_spi
  *
  *  Set ciritical section enter blocking function.
- *  If the spin lock associated with this critical section is in use, then this
- *  method will block until it is released.
+ *  Before the scheduler starts this enters the spin lock critical section,
+ *  afterwards it takes a mutex so that interrupts stay enabled during DMA transfers.
  *
  *  \param none
  */
@@ -124,10 +167,54 @@ static void wizchip_critical_section_unlock(void);
  */
 void wizchip_spi_initialize(void);
 
+/*! \brief Set SPI clock
+ *  \ingroup w5x00_spi
+ *
+ *  Change the SPI clock at runtime.
+ *
+ *  \param baudrate Baudrate requested in Hz
+ *  \return the actual baudrate set
+ */
+uint32_t wizchip_spi_set_baudrate(uint32_t baudrate);
+
+/*! \brief Get SPI clock
+ *  \ingroup w5x00_spi
+ *
+ *  Get the current SPI clock.
+ *
+ *  \param none
+ *  \return the actual baudrate in Hz
+ */
+uint32_t wizchip_spi_get_baudrate(void);
+
+/*! \brief Probe the fastest stable SPI clock
+ *  \ingroup w5x00_spi
+ *
+ *  Try each candidate clock from the fastest down and keep the first one at which
+ *  WIZCHIP_SPI_PROBE_READS consecutive version register reads return the expected value
+ *  and WIZCHIP_SPI_PROBE_BURSTS patterns written to the socket 0 TX buffer read back intact.
+ *  The buffer round trips go through the same burst path as the RX and TX data.
+ *  Call it after wizchip_initialize(), before other tasks use the chip and before socket 0 is opened.
+ *
+ *  \param none
+ *  \return the selected baudrate in Hz
+ */
+uint32_t wizchip_spi_probe_baudrate(void);
+
+/*! \brief SPI benchmark
+ *  \ingroup w5x00_spi
+ *
+ *  Print sustained register read and bulk buffer read throughput at the current clock.
+ *  Bulk reads use the socket 0 RX buffer without moving Sn_RX_RD.
+ *
+ *  \param none
+ */
+void wizchip_spi_benchmark(void);
+
 /*! \brief Initialize a critical section structure
  *  \ingroup w5x00_spi
  *
- *  The critical section is initialized ready for use.
+ *  The critical section and the mutex are initialized ready for use.
  *  Registers callback function for critical section for WIZchip.
  *
  *  \param none
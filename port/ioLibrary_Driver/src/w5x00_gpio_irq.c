@@ -36,7 +36,7 @@ void wizchip_gpio_interrupt_initialize(uint8_t socket, void (*callback)(void))
     uint16_t reg_val;
     int ret_val;
 
-    reg_val = (SIK_CONNECTED | SIK_DISCONNECTED | SIK_RECEIVED | SIK_TIMEOUT); // except SendOK
+    reg_val = (SIK_CONNECTED | SIK_DISCONNECTED | SIK_RECEIVED | SIK_TIMEOUT | SIK_SENT);
     ret_val = ctlsocket(socket, CS_SET_INTMASK, (void *)&reg_val);
 
 #if (_WIZCHIP_ == W5100S)
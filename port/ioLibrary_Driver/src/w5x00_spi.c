@@ -10,8 +10,15 @@
  * ----------------------------------------------------------------------------------------------------
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "port_common.h"
+#include "hardware/irq.h"
+
+#include <FreeRTOS.h>
+#include <task.h>
+#include <semphr.h>
 
 #include "wizchip_conf.h"
 #include "w5x00_spi.h"
@@ -22,14 +29,91 @@
  * ----------------------------------------------------------------------------------------------------
  */
 static critical_section_t g_wizchip_cri_sec;
+static SemaphoreHandle_t g_wizchip_mutex = NULL;
+static bool g_wizchip_mutex_taken = false;
 
 #ifdef USE_SPI_DMA
 static uint dma_tx;
 static uint dma_rx;
+static uint dma_tx_hdr;
+static uint dma_rx_hdr;
 static dma_channel_config dma_channel_config_tx;
 static dma_channel_config dma_channel_config_rx;
+static dma_channel_config dma_channel_config_tx_hdr;
+static dma_channel_config dma_channel_config_rx_hdr;
+
+static uint8_t dma_dummy_tx = 0xFF;
+static uint8_t dma_dummy_rx;
+
+/* Address/control phase held back so that it goes out together with the data phase */
+static uint8_t spi_header[3];
+static bool spi_header_pending = false;
+
+/* Task blocked on the current asynchronous transfer */
+static volatile TaskHandle_t dma_waiting_task = NULL;
+static wizchip_dma_stats_t dma_stats;
 #endif
 
+/* SPI clock probe candidates, fastest first. The divider rounds them down from clk_peri, the
+ * probe skips a candidate that lands on the clock already tried. */
+static const uint32_t spi_baudrate_table[] = {
+    62500 * 1000,
+    50000 * 1000,
+    40000 * 1000,
+    33000 * 1000,
+    25000 * 1000,
+    20000 * 1000,
+    10000 * 1000,
+    WIZCHIP_SPI_BAUDRATE_DEFAULT,
+};
+
+#ifdef USE_SPI_DMA
+/*! \brief Run one SPI burst, blocking
+ *  \ingroup w5x00_spi
+ *
+ *  If an address/control phase is pending it is sent first through the header
+ *  DMA channels, which chain into the data channels so that header and payload
+ *  form one continuous transfer. Bursts shorter than WIZCHIP_SPI_DMA_MIN_LEN
+ *  use blocking transfers instead of DMA. Bursts of at least
+ *  WIZCHIP_SPI_DMA_ASYNC_MIN_LEN issued from a task block on a task notification
+ *  given by the DMA interrupt, so other tasks run during the transfer.
+ *
+ *  \param tx_buf Buffer of data to write, or NULL to clock out dummy bytes
+ *  \param rx_buf Buffer of data to read, or NULL to discard received bytes
+ *  \param len element count (each element is of size transfer_data_size)
+ */
+static void wizchip_transfer_burst(uint8_t *tx_buf, uint8_t *rx_buf, uint16_t len);
+
+/*! \brief DMA completion interrupt handler
+ *  \ingroup w5x00_spi
+ *
+ *  Acknowledge the data RX channel interrupt and notify the task waiting for the transfer.
+ *
+ *  \param none
+ */
+static void wizchip_dma_irq_handler(void);
+#endif
+
+/*! \brief Read chip version
+ *  \ingroup w5x00_spi
+ *
+ *  Read the version register.
+ *
+ *  \param none
+ *  \return the version register value
+ */
+static uint8_t wizchip_read_version(void);
+
+/*! \brief Check bulk transfers at the current SPI clock
+ *  \ingroup w5x00_spi
+ *
+ *  Write WIZCHIP_SPI_PROBE_BURSTS patterns into the socket 0 TX buffer and read each back.
+ *
+ *  \param none
+ *  \return true if every pattern read back intact
+ */
+static bool wizchip_spi_probe_burst(void);
+
 /**
  * ----------------------------------------------------------------------------------------------------
  * Functions
@@ -64,6 +148,20 @@ static uint8_t wizchip_read(void)
     uint8_t rx_data = 0;
     uint8_t tx_data = 0xFF;
 
+#ifdef USE_SPI_DMA
+    if (spi_header_pending)
+    {
+        // Register read: header and data byte in one blocking transfer
+        uint8_t tx_buf[4] = {spi_header[0], spi_header[1], spi_header[2], tx_data};
+        uint8_t rx_buf[4];
+
+        spi_header_pending = false;
+        spi_write_read_blocking(SPI_PORT, tx_buf, rx_buf, 4);
+
+        return rx_buf[3];
+    }
+#endif
+
     spi_read_blocking(SPI_PORT, tx_data, &rx_data, 1);
 
     return rx_data;
@@ -71,73 +169,210 @@ static uint8_t wizchip_read(void)
 
 static void wizchip_write(uint8_t tx_data)
 {
+#ifdef USE_SPI_DMA
+    if (spi_header_pending)
+    {
+        uint8_t tx_buf[4] = {spi_header[0], spi_header[1], spi_header[2], tx_data};
+
+        spi_header_pending = false;
+        spi_write_blocking(SPI_PORT, tx_buf, 4);
+
+        return;
+    }
+#endif
+
     spi_write_blocking(SPI_PORT, &tx_data, 1);
 }
 
 #ifdef USE_SPI_DMA
-static void wizchip_read_burst(uint8_t *pBuf, uint16_t len)
+static void wizchip_transfer_burst(uint8_t *tx_buf, uint8_t *rx_buf, uint16_t len)
 {
-    uint8_t dummy_data = 0xFF;
+    bool header = spi_header_pending;
+
+    spi_header_pending = false;
+
+    if (len < WIZCHIP_SPI_DMA_MIN_LEN)
+    {
+        // Too short to be worth a DMA setup
+        if (header)
+            spi_write_blocking(SPI_PORT, spi_header, 3);
+
+        if (rx_buf != NULL)
+            spi_read_blocking(SPI_PORT, dma_dummy_tx, rx_buf, len);
+        else
+            spi_write_blocking(SPI_PORT, tx_buf, len);
+
+        return;
+    }
 
-    channel_config_set_read_increment(&dma_channel_config_tx, false);
+    channel_config_set_read_increment(&dma_channel_config_tx, tx_buf != NULL);
     channel_config_set_write_increment(&dma_channel_config_tx, false);
     dma_channel_configure(dma_tx, &dma_channel_config_tx,
-                          &spi_get_hw(SPI_PORT)->dr, // write address
-                          &dummy_data,               // read address
-                          len,                       // element count (each element is of size transfer_data_size)
-                          false);                    // don't start yet
+                          &spi_get_hw(SPI_PORT)->dr,                  // write address
+                          tx_buf != NULL ? tx_buf : &dma_dummy_tx,    // read address
+                          len,                                        // element count (each element is of size transfer_data_size)
+                          false);                                     // don't start yet
 
     channel_config_set_read_increment(&dma_channel_config_rx, false);
-    channel_config_set_write_increment(&dma_channel_config_rx, true);
+    channel_config_set_write_increment(&dma_channel_config_rx, rx_buf != NULL);
     dma_channel_configure(dma_rx, &dma_channel_config_rx,
-                          pBuf,                      // write address
-                          &spi_get_hw(SPI_PORT)->dr, // read address
-                          len,                       // element count (each element is of size transfer_data_size)
-                          false);                    // don't start yet
+                          rx_buf != NULL ? rx_buf : &dma_dummy_rx,    // write address
+                          &spi_get_hw(SPI_PORT)->dr,                  // read address
+                          len,                                        // element count (each element is of size transfer_data_size)
+                          false);                                     // don't start yet
+
+    // Long transfers from a task sleep until the DMA interrupt, the others spin
+    bool async = (len >= WIZCHIP_SPI_DMA_ASYNC_MIN_LEN) &&
+                 (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) && !portCHECK_IF_IN_ISR();
+
+    // Completion is taken from the raw interrupt status, as dma_rx may only be triggered by the chain
+    dma_hw->intr = 1u << dma_rx;
+
+    if (async)
+    {
+        dma_waiting_task = xTaskGetCurrentTaskHandle();
+        xTaskNotifyStateClearIndexed(NULL, WIZCHIP_DMA_NOTIFY_INDEX);
+        dma_channel_set_irq0_enabled(dma_rx, true);
+    }
+
+    if (header)
+    {
+        // The header channels chain into the data channels, so CS sees one continuous transfer
+        dma_channel_configure(dma_tx_hdr, &dma_channel_config_tx_hdr,
+                              &spi_get_hw(SPI_PORT)->dr, // write address
+                              spi_header,                // read address
+                              3,                         // element count (each element is of size transfer_data_size)
+                              false);                    // don't start yet
+
+        dma_channel_configure(dma_rx_hdr, &dma_channel_config_rx_hdr,
+                              &dma_dummy_rx,             // write address
+                              &spi_get_hw(SPI_PORT)->dr, // read address
+                              3,                         // element count (each element is of size transfer_data_size)
+                              false);                    // don't start yet
+
+        dma_start_channel_mask((1u << dma_tx_hdr) | (1u << dma_rx_hdr));
+    }
+    else
+    {
+        dma_start_channel_mask((1u << dma_tx) | (1u << dma_rx));
+    }
 
-    dma_start_channel_mask((1u << dma_tx) | (1u << dma_rx));
-    dma_channel_wait_for_finish_blocking(dma_rx);
+    if (async)
+    {
+        uint64_t start = time_us_64();
+
+        ulTaskNotifyTakeIndexed(WIZCHIP_DMA_NOTIFY_INDEX, pdTRUE, portMAX_DELAY);
+
+        dma_channel_set_irq0_enabled(dma_rx, false);
+        dma_waiting_task = NULL;
+
+        dma_stats.async_transfers++;
+        dma_stats.async_bytes += len;
+        dma_stats.async_wait_us += time_us_64() - start;
+
+        return;
+    }
+
+    while (!(dma_hw->intr & (1u << dma_rx)))
+        tight_loop_contents();
+
+    dma_stats.sync_transfers++;
+    dma_stats.sync_bytes += len;
 }
 
-static void wizchip_write_burst(uint8_t *pBuf, uint16_t len)
+static void wizchip_dma_irq_handler(void)
 {
-    uint8_t dummy_data;
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
 
-    channel_config_set_read_increment(&dma_channel_config_tx, true);
-    channel_config_set_write_increment(&dma_channel_config_tx, false);
-    dma_channel_configure(dma_tx, &dma_channel_config_tx,
-                          &spi_get_hw(SPI_PORT)->dr, // write address
-                          pBuf,                      // read address
-                          len,                       // element count (each element is of size transfer_data_size)
-                          false);                    // don't start yet
+    if (!dma_channel_get_irq0_status(dma_rx))
+    {
+        return;
+    }
 
-    channel_config_set_read_increment(&dma_channel_config_rx, false);
-    channel_config_set_write_increment(&dma_channel_config_rx, false);
-    dma_channel_configure(dma_rx, &dma_channel_config_rx,
-                          &dummy_data,               // write address
-                          &spi_get_hw(SPI_PORT)->dr, // read address
-                          len,                       // element count (each element is of size transfer_data_size)
-                          false);                    // don't start yet
+    dma_channel_acknowledge_irq0(dma_rx);
+
+    if (dma_waiting_task != NULL)
+    {
+        vTaskNotifyGiveIndexedFromISR(dma_waiting_task, WIZCHIP_DMA_NOTIFY_INDEX, &xHigherPriorityTaskWoken);
+    }
+
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
 
-    dma_start_channel_mask((1u << dma_tx) | (1u << dma_rx));
-    dma_channel_wait_for_finish_blocking(dma_rx);
+void wizchip_dma_get_stats(wizchip_dma_stats_t *stats)
+{
+    *stats = dma_stats;
+}
+
+static void wizchip_read_burst(uint8_t *pBuf, uint16_t len)
+{
+    wizchip_transfer_burst(NULL, pBuf, len);
+}
+
+static void wizchip_write_burst(uint8_t *pBuf, uint16_t len)
+{
+    if (!spi_header_pending && len == 3)
+    {
+        // Every ioLibrary access starts with a 3 byte address/control phase, keep it for the data phase
+        memcpy(spi_header, pBuf, 3);
+        spi_header_pending = true;
+
+        return;
+    }
+
+    wizchip_transfer_burst(pBuf, NULL, len);
 }
 #endif
 
 static void wizchip_critical_section_lock(void)
 {
+    BaseType_t state = xTaskGetSchedulerState();
+
+    // Once tasks run, a mutex keeps interrupts enabled so that DMA transfers can sleep
+    if (g_wizchip_mutex != NULL && state == taskSCHEDULER_RUNNING)
+    {
+        xSemaphoreTake(g_wizchip_mutex, portMAX_DELAY);
+        g_wizchip_mutex_taken = true;
+
+        return;
+    }
+
+    // Blocking is not allowed while the scheduler is suspended, so poll the mutex with a zero
+    // timeout. Only a holder running on the other core can give it back in the meantime.
+    if (g_wizchip_mutex != NULL && state == taskSCHEDULER_SUSPENDED)
+    {
+        while (xSemaphoreTake(g_wizchip_mutex, 0) != pdTRUE)
+        {
+            TaskHandle_t holder = xSemaphoreGetMutexHolder(g_wizchip_mutex);
+
+            configASSERT(holder == NULL || eTaskGetState(holder) == eRunning);
+            tight_loop_contents();
+        }
+        g_wizchip_mutex_taken = true;
+
+        return;
+    }
+
     critical_section_enter_blocking(&g_wizchip_cri_sec);
 }
 
 static void wizchip_critical_section_unlock(void)
 {
-    critical_section_exit(&g_wizchip_cri_sec);
+    if (g_wizchip_mutex_taken)
+    {
+        g_wizchip_mutex_taken = false;
+        xSemaphoreGive(g_wizchip_mutex);
+    }
+    else
+    {
+        critical_section_exit(&g_wizchip_cri_sec);
+    }
 }
 
 void wizchip_spi_initialize(void)
 {
-    // this example will use SPI0 at 5MHz
-    spi_init(SPI_PORT, 5000 * 1000);
+    // start SPI0 at a clock every board handles, wizchip_spi_probe_baudrate() can raise it later
+    spi_init(SPI_PORT, WIZCHIP_SPI_BAUDRATE_DEFAULT);
 
     gpio_set_function(PIN_SCK, GPIO_FUNC_SPI);
     gpio_set_function(PIN_MOSI, GPIO_FUNC_SPI);
@@ -170,12 +405,155 @@ void wizchip_spi_initialize(void)
     channel_config_set_dreq(&dma_channel_config_rx, DREQ_SPI0_RX);
     channel_config_set_read_increment(&dma_channel_config_rx, false);
     channel_config_set_write_increment(&dma_channel_config_rx, true);
+
+    // The header channels send the 3 byte address/control phase and chain into the data channels
+    dma_tx_hdr = dma_claim_unused_channel(true);
+    dma_rx_hdr = dma_claim_unused_channel(true);
+
+    dma_channel_config_tx_hdr = dma_channel_get_default_config(dma_tx_hdr);
+    channel_config_set_transfer_data_size(&dma_channel_config_tx_hdr, DMA_SIZE_8);
+    channel_config_set_dreq(&dma_channel_config_tx_hdr, DREQ_SPI0_TX);
+    channel_config_set_read_increment(&dma_channel_config_tx_hdr, true);
+    channel_config_set_write_increment(&dma_channel_config_tx_hdr, false);
+    channel_config_set_chain_to(&dma_channel_config_tx_hdr, dma_tx);
+
+    dma_channel_config_rx_hdr = dma_channel_get_default_config(dma_rx_hdr);
+    channel_config_set_transfer_data_size(&dma_channel_config_rx_hdr, DMA_SIZE_8);
+    channel_config_set_dreq(&dma_channel_config_rx_hdr, DREQ_SPI0_RX);
+    channel_config_set_read_increment(&dma_channel_config_rx_hdr, false);
+    channel_config_set_write_increment(&dma_channel_config_rx_hdr, false);
+    channel_config_set_chain_to(&dma_channel_config_rx_hdr, dma_rx);
+
+    // Completion interrupt for asynchronous transfers, enabled per transfer.
+    // It is taken on the initializing core and wakes the waiting task on either core.
+    irq_add_shared_handler(DMA_IRQ_0, wizchip_dma_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_0, true);
+#endif
+}
+
+uint32_t wizchip_spi_set_baudrate(uint32_t baudrate)
+{
+    return spi_set_baudrate(SPI_PORT, baudrate);
+}
+
+uint32_t wizchip_spi_get_baudrate(void)
+{
+    return spi_get_baudrate(SPI_PORT);
+}
+
+uint32_t wizchip_spi_probe_baudrate(void)
+{
+    uint32_t tried = 0;
+
+    for (uint i = 0; i < count_of(spi_baudrate_table); i++)
+    {
+        uint32_t baudrate = wizchip_spi_set_baudrate(spi_baudrate_table[i]);
+        uint32_t reads = 0;
+
+        if (baudrate == tried)
+        {
+            continue;
+        }
+        tried = baudrate;
+
+        while (reads < WIZCHIP_SPI_PROBE_READS && wizchip_read_version() == WIZCHIP_VERSION)
+        {
+            reads++;
+        }
+
+        // Single register reads can pass at a clock where long bursts still corrupt data
+        if (reads == WIZCHIP_SPI_PROBE_READS && wizchip_spi_probe_burst())
+        {
+            return baudrate;
+        }
+
+        printf(" SPI probe : %lu Hz unstable\n", baudrate);
+    }
+
+    // Nothing was stable, fall back to the boot clock
+    return wizchip_spi_set_baudrate(WIZCHIP_SPI_BAUDRATE_DEFAULT);
+}
+
+static bool wizchip_spi_probe_burst(void)
+{
+    static uint8_t pattern[WIZCHIP_SPI_PROBE_BURST_LEN];
+    static uint8_t readback[WIZCHIP_SPI_PROBE_BURST_LEN];
+#if (_WIZCHIP_ == W5100S)
+    uint32_t addr = getSn_TxBASE(0);
+#elif (_WIZCHIP_ == W5500)
+    uint32_t addr = (WIZCHIP_TXBUF_BLOCK(0) << 3);
 #endif
+
+    for (uint32_t burst = 0; burst < WIZCHIP_SPI_PROBE_BURSTS; burst++)
+    {
+        // Alternate all-ones, all-zeros and counting bytes so that every bit toggles at full rate
+        for (uint32_t i = 0; i < WIZCHIP_SPI_PROBE_BURST_LEN; i++)
+        {
+            pattern[i] = (i & 1) ? (uint8_t)(i * 7 + burst) : ((burst & 1) ? 0xFF : 0x00);
+        }
+        memset(readback, ~pattern[0], WIZCHIP_SPI_PROBE_BURST_LEN);
+
+        WIZCHIP_WRITE_BUF(addr, pattern, WIZCHIP_SPI_PROBE_BURST_LEN);
+        WIZCHIP_READ_BUF(addr, readback, WIZCHIP_SPI_PROBE_BURST_LEN);
+
+        if (memcmp(pattern, readback, WIZCHIP_SPI_PROBE_BURST_LEN) != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void wizchip_spi_benchmark(void)
+{
+    const uint32_t reg_reads = 10000;
+    const uint32_t buf_reads = 200;
+    const uint16_t buf_len = 2048;
+    uint8_t *buf = malloc(buf_len);
+    uint64_t start;
+    uint64_t elapsed;
+
+    if (buf == NULL)
+    {
+        printf(" SPI benchmark : no memory\n");
+
+        return;
+    }
+
+    printf(" SPI benchmark at %lu Hz\n", wizchip_spi_get_baudrate());
+
+    // Register reads, one payload byte per transaction
+    start = time_us_64();
+    for (uint32_t i = 0; i < reg_reads; i++)
+    {
+        wizchip_read_version();
+    }
+    elapsed = time_us_64() - start;
+    printf(" Register read : %lu reads/s, %lu.%03lu MB/s\n",
+           (uint32_t)((uint64_t)reg_reads * 1000000 / elapsed),
+           (uint32_t)(reg_reads / elapsed), (uint32_t)((uint64_t)reg_reads * 1000 / elapsed % 1000));
+
+#if (_WIZCHIP_ == W5500)
+    // Bulk reads from the socket 0 RX buffer, leaving Sn_RX_RD untouched
+    start = time_us_64();
+    for (uint32_t i = 0; i < buf_reads; i++)
+    {
+        WIZCHIP_READ_BUF((WIZCHIP_RXBUF_BLOCK(0) << 3), buf, buf_len);
+    }
+    elapsed = time_us_64() - start;
+    printf(" Buffer read   : %lu.%03lu MB/s\n",
+           (uint32_t)((uint64_t)buf_reads * buf_len / elapsed),
+           (uint32_t)((uint64_t)buf_reads * buf_len * 1000 / elapsed % 1000));
+#endif
+
+    free(buf);
 }
 
 void wizchip_cris_initialize(void)
 {
     critical_section_init(&g_wizchip_cri_sec);
+    g_wizchip_mutex = xSemaphoreCreateMutex();
     reg_wizchip_cris_cbfunc(wizchip_critical_section_lock, wizchip_critical_section_unlock);
 }
 
@@ -220,27 +598,25 @@ void wizchip_initialize(void)
     } while (temp == PHY_LINK_OFF);
 }
 
-void wizchip_check(void)
+static uint8_t wizchip_read_version(void)
 {
 #if (_WIZCHIP_ == W5100S)
-    /* Read version register */
-    if (getVER() != 0x51)
-    {
-        printf(" ACCESS ERR : VERSION != 0x51, read value = 0x%02x\n", getVER());
-
-        while (1)
-            ;
-    }
+    return getVER();
 #elif (_WIZCHIP_ == W5500)
+    return getVERSIONR();
+#endif
+}
+
+void wizchip_check(void)
+{
     /* Read version register */
-    if (getVERSIONR() != 0x04)
+    if (wizchip_read_version() != WIZCHIP_VERSION)
     {
-        printf(" ACCESS ERR : VERSION != 0x04, read value = 0x%02x\n", getVERSIONR());
+        printf(" ACCESS ERR : VERSION != 0x%02x, read value = 0x%02x\n", WIZCHIP_VERSION, wizchip_read_version());
 
         while (1)
             ;
     }
-#endif
 }
 
 /* Network */
@@ -17,11 +17,20 @@
 
 #include "netif/etharp.h"
 #include <string.h>
+
+#include "pico/time.h"
+
+#include <FreeRTOS.h>
+#include <semphr.h>
+
 /**
  * ----------------------------------------------------------------------------------------------------
  * Macros
  * ----------------------------------------------------------------------------------------------------
  */
+/* TX queue */
+#define TX_QUEUE_DEPTH 8       // frames staged in the chip TX buffer, including the one in flight
+#define TX_STALL_TIMEOUT_MS 10 // re-poll Sn_IR while stalled, in case a SENDOK interrupt is missed
 
 /**
  * ----------------------------------------------------------------------------------------------------
@@ -30,49 +39,253 @@
  */
 uint8_t mac[6] = {0x00, 0x08, 0xDC, 0x12, 0x34, 0x56};
 
-static uint8_t tx_frame[1542];
-static const uint32_t ethernet_polynomial_le = 0xedb88320U;
+static uint8_t tx_pad[ETHERNET_FRAME_MIN_SIZE];
+
+/* TX queue, frames are written ahead of Sn_TX_WR and handed to the chip one SEND at a time */
+static struct
+{
+    uint16_t wr;                  // staging write pointer, runs ahead of Sn_TX_WR
+    uint16_t reg_wr;              // last value written to Sn_TX_WR
+    uint16_t end[TX_QUEUE_DEPTH]; // end pointer of each queued frame, the head one is in flight
+    uint8_t head;
+    uint8_t count;
+    SemaphoreHandle_t lock;
+    SemaphoreHandle_t space;
+} tx_queue;
+
+static w5x00_tx_stats_t tx_stats;
 
 /**
  * ----------------------------------------------------------------------------------------------------
  * Functions
  * ----------------------------------------------------------------------------------------------------
  */
+/*! \brief wait for TX buffer space
+ *  \ingroup w5x00_lwip
+ *
+ *  Blocks until a queue slot and len bytes of TX buffer are free.
+ *  Together with send_lwip_enqueue() it assumes a single sender task: nothing
+ *  else may stage a frame between the two calls.
+ *  Space is tracked through Sn_TX_FSR minus the data staged ahead of Sn_TX_WR.
+ *
+ *  \param sn socket number
+ *  \param len the length of the frame to stage
+ *  \return the staging pointer to write the frame at
+ */
+static uint16_t send_lwip_reserve(uint8_t sn, uint16_t len);
+
+/*! \brief write data into the TX buffer
+ *  \ingroup w5x00_lwip
+ *
+ *  Writes data at a staging pointer without touching Sn_TX_WR,
+ *  so it does not interfere with the frame currently being sent.
+ *
+ *  \param sn socket number
+ *  \param ptr the staging pointer
+ *  \param buf a pointer to the data to write
+ *  \param len the length of the data
+ *  \return the advanced staging pointer
+ */
+static uint16_t send_lwip_write(uint8_t sn, uint16_t ptr, uint8_t *buf, uint16_t len);
+
+/*! \brief queue the staged frame
+ *  \ingroup w5x00_lwip
+ *
+ *  Records the end of the staged frame and starts it if the chip is idle.
+ *
+ *  \param sn socket number
+ *  \param wr the staging pointer after the frame
+ */
+static void send_lwip_enqueue(uint8_t sn, uint16_t wr);
+
+/*! \brief start the frame at the head of the queue
+ *  \ingroup w5x00_lwip
+ *
+ *  Moves Sn_TX_WR to the end of the head frame and issues SEND.
+ *
+ *  \param sn socket number
+ */
+static void send_lwip_kick(uint8_t sn);
+
 int32_t send_lwip(uint8_t sn, uint8_t *buf, uint16_t len)
 {
-    uint8_t tmp = 0;
     uint16_t freesize = 0;
-
-    tmp = getSn_SR(sn);
+    uint16_t wr = 0;
 
     freesize = getSn_TxMAX(sn);
     if (len > freesize)
         len = freesize; // check size not to exceed MAX size.
 
-    wiz_send_data(sn, buf, len);
-    setSn_CR(sn, Sn_CR_SEND);
-    while (getSn_CR(sn))
-        ;
+    wr = send_lwip_reserve(sn, len);
+    wr = send_lwip_write(sn, wr, buf, len);
+    send_lwip_enqueue(sn, wr);
+
+    return (int32_t)len;
+}
+
+void send_lwip_poll(uint8_t sn)
+{
+    uint8_t ir;
+
+    xSemaphoreTake(tx_queue.lock, portMAX_DELAY);
+
+    ir = getSn_IR(sn) & (Sn_IR_SENDOK | Sn_IR_TIMEOUT);
+
+    if (ir)
+    {
+        setSn_IR(sn, ir);
+
+        if (tx_queue.count > 0)
+        {
+            if (ir & Sn_IR_TIMEOUT)
+            {
+                //  There was a timeout
+                tx_stats.timeouts++;
+            }
+            else
+            {
+                tx_stats.frames_sent++;
+            }
+
+            tx_queue.head = (tx_queue.head + 1) % TX_QUEUE_DEPTH;
+            tx_queue.count--;
+
+            if (tx_queue.count > 0)
+            {
+                send_lwip_kick(sn);
+            }
+        }
+    }
+
+    xSemaphoreGive(tx_queue.lock);
+
+    if (ir)
+    {
+        xSemaphoreGive(tx_queue.space);
+    }
+}
+
+void send_lwip_get_stats(w5x00_tx_stats_t *stats)
+{
+    xSemaphoreTake(tx_queue.lock, portMAX_DELAY);
+    *stats = tx_stats;
+    stats->queue_depth = tx_queue.count;
+    xSemaphoreGive(tx_queue.lock);
+}
+
+static uint16_t send_lwip_reserve(uint8_t sn, uint16_t len)
+{
+    uint64_t stall_start = 0;
+    uint16_t freesize = 0;
+    uint16_t wr = 0;
 
     while (1)
     {
-        uint8_t IRtemp = getSn_IR(sn);
-        if (IRtemp & Sn_IR_SENDOK)
+        xSemaphoreTake(tx_queue.lock, portMAX_DELAY);
+
+        if (tx_queue.count == 0)
         {
-            setSn_IR(sn, Sn_IR_SENDOK);
-            // printf("Packet sent ok\n");
-            break;
+            // Nothing in flight, resynchronise with the chip (e.g. after the socket was opened)
+            tx_queue.reg_wr = getSn_TX_WR(sn);
+            tx_queue.wr = tx_queue.reg_wr;
+            freesize = getSn_TxMAX(sn);
+        }
+        else if (tx_queue.count < TX_QUEUE_DEPTH)
+        {
+            // Sn_TX_FSR only accounts for the frames already handed to the chip
+            freesize = getSn_TX_FSR(sn) - (uint16_t)(tx_queue.wr - tx_queue.reg_wr);
+        }
+        else
+        {
+            freesize = 0;
+        }
+
+        if (freesize >= len)
+        {
+            if (stall_start != 0)
+            {
+                tx_stats.stall_time_us += time_us_64() - stall_start;
+            }
+            wr = tx_queue.wr;
+
+            xSemaphoreGive(tx_queue.lock);
+            return wr;
+        }
+
+        // The stats are shared with send_lwip_poll() on the other core
+        if (stall_start == 0)
+        {
+            stall_start = time_us_64();
+            tx_stats.stalls++;
         }
-        else if (IRtemp & Sn_IR_TIMEOUT)
+
+        xSemaphoreGive(tx_queue.lock);
+
+        if (xSemaphoreTake(tx_queue.space, pdMS_TO_TICKS(TX_STALL_TIMEOUT_MS)) != pdTRUE)
         {
-            setSn_IR(sn, Sn_IR_TIMEOUT);
-            // printf("Socket is closed\n");
-            //  There was a timeout
-            return -1;
+            send_lwip_poll(sn);
         }
     }
+}
 
-    return (int32_t)len;
+static uint16_t send_lwip_write(uint8_t sn, uint16_t ptr, uint8_t *buf, uint16_t len)
+{
+    if (len == 0)
+        return ptr;
+
+#if (_WIZCHIP_ == W5100S)
+    uint16_t dst_mask = ptr & getSn_TxMASK(sn);
+    uint32_t dst_ptr = getSn_TxBASE(sn) + dst_mask;
+    uint16_t size = len;
+
+    if (dst_mask + len > getSn_TxMAX(sn))
+    {
+        size = getSn_TxMAX(sn) - dst_mask;
+        WIZCHIP_WRITE_BUF(dst_ptr, buf, size);
+        buf += size;
+        size = len - size;
+        dst_ptr = getSn_TxBASE(sn);
+    }
+    WIZCHIP_WRITE_BUF(dst_ptr, buf, size);
+#elif (_WIZCHIP_ == W5500)
+    uint32_t addrsel = ((uint32_t)ptr << 8) + (WIZCHIP_TXBUF_BLOCK(sn) << 3);
+
+    WIZCHIP_WRITE_BUF(addrsel, buf, len);
+#endif
+
+    return ptr + len;
+}
+
+static void send_lwip_enqueue(uint8_t sn, uint16_t wr)
+{
+    xSemaphoreTake(tx_queue.lock, portMAX_DELAY);
+
+    tx_queue.wr = wr;
+    tx_queue.end[(tx_queue.head + tx_queue.count) % TX_QUEUE_DEPTH] = tx_queue.wr;
+    tx_queue.count++;
+
+    if (tx_queue.count > tx_stats.queue_depth_max)
+    {
+        tx_stats.queue_depth_max = tx_queue.count;
+    }
+
+    // The chip is idle, start this frame right away
+    if (tx_queue.count == 1)
+    {
+        send_lwip_kick(sn);
+    }
+
+    xSemaphoreGive(tx_queue.lock);
+}
+
+static void send_lwip_kick(uint8_t sn)
+{
+    tx_queue.reg_wr = tx_queue.end[tx_queue.head];
+    setSn_TX_WR(sn, tx_queue.reg_wr);
+
+    setSn_CR(sn, Sn_CR_SEND);
+    while (getSn_CR(sn))
+        ;
 }
 
 int32_t recv_lwip(uint8_t sn, uint8_t *buf, uint16_t len)
@@ -107,16 +320,63 @@ int32_t recv_lwip(uint8_t sn, uint8_t *buf, uint16_t len)
     return (int32_t)pack_len;
 }
 
+struct pbuf *recv_lwip_pbuf(uint8_t sn)
+{
+    uint8_t head[2];
+    uint16_t pack_len = 0;
+    struct pbuf *p = NULL;
+
+    wiz_recv_data(sn, head, 2);
+
+    // byte size of data packet (2byte)
+    pack_len = head[0];
+    pack_len = (pack_len << 8) + head[1];
+    pack_len -= 2;
+
+    if (pack_len <= ETHERNET_FRAME_MAX_SIZE)
+    {
+        p = pbuf_alloc(PBUF_RAW, pack_len, PBUF_POOL);
+    }
+
+    if (p != NULL)
+    {
+        // Read the frame straight into the pool buffers, one segment at a time
+        for (struct pbuf *q = p; q != NULL; q = q->next)
+        {
+            wiz_recv_data(sn, (uint8_t *)q->payload, q->len);
+        }
+    }
+    else
+    {
+        // Packet is too big or the pool is exhausted - drop the packet
+        wiz_recv_ignore(sn, pack_len);
+        LINK_STATS_INC(link.drop);
+    }
+
+    setSn_CR(sn, Sn_CR_RECV);
+    while (getSn_CR(sn))
+        ;
+
+    return p;
+}
+
 err_t netif_output(struct netif *netif, struct pbuf *p)
 {
-    uint32_t send_len = 0;
-    uint32_t tot_len = 0;
+    uint16_t tot_len = 0;
+    uint16_t ptr = 0;
 
-    memset(tx_frame, 0x00, sizeof(tx_frame));
+    if (p->tot_len > ETHERNET_FRAME_MAX_SIZE)
+    {
+        LINK_STATS_INC(link.lenerr);
+        return ERR_BUF;
+    }
+
+    // Stream every segment into the TX buffer ahead of the frame currently on the wire
+    ptr = send_lwip_reserve(0, (p->tot_len < ETHERNET_FRAME_MIN_SIZE) ? ETHERNET_FRAME_MIN_SIZE : p->tot_len);
 
     for (struct pbuf *q = p; q != NULL; q = q->next)
     {
-        memcpy(tx_frame + tot_len, q->payload, q->len);
+        ptr = send_lwip_write(0, ptr, (uint8_t *)q->payload, q->len);
 
         tot_len += q->len;
 
@@ -126,15 +386,15 @@ err_t netif_output(struct netif *netif, struct pbuf *p)
         }
     }
 
-    if (tot_len < 60)
+    if (tot_len < ETHERNET_FRAME_MIN_SIZE)
     {
         // pad
-        tot_len = 60;
+        ptr = send_lwip_write(0, ptr, tx_pad, ETHERNET_FRAME_MIN_SIZE - tot_len);
     }
 
-    uint32_t crc = ethernet_frame_crc(tx_frame, tot_len);
+    send_lwip_enqueue(0, ptr);
 
-    send_len = send_lwip(0, tx_frame, tot_len);
+    LINK_STATS_INC(link.xmit);
 
     return ERR_OK;
 }
@@ -151,6 +411,17 @@ void netif_status_callback(struct netif *netif)
 
 err_t netif_initialize(struct netif *netif)
 {
+    if (tx_queue.lock == NULL)
+    {
+        tx_queue.lock = xSemaphoreCreateMutex();
+        tx_queue.space = xSemaphoreCreateBinary();
+
+        if (tx_queue.lock == NULL || tx_queue.space == NULL)
+        {
+            return ERR_MEM;
+        }
+    }
+
     netif->linkoutput = netif_output;
     netif->output = etharp_output;
     netif->mtu = ETHERNET_MTU;
@@ -159,26 +430,3 @@ err_t netif_initialize(struct netif *netif)
     netif->hwaddr_len = sizeof(netif->hwaddr);
     return ERR_OK;
 }
-
-static uint32_t ethernet_frame_crc(const uint8_t *data, int length)
-{
-    uint32_t crc = 0xffffffff; /* Initial value. */
-
-    while (--length >= 0)
-    {
-        uint8_t current_octet = *data++;
-
-        for (int bit = 8; --bit >= 0; current_octet >>= 1)
-        {
-            if ((crc ^ current_octet) & 1)
-            {
-                crc >>= 1;
-                crc ^= ethernet_polynomial_le;
-            }
-            else
-                crc >>= 1;
-        }
-    }
-
-    return ~crc;
-}
@@ -21,12 +21,24 @@
  */
 /* LWIP */
 #define ETHERNET_MTU 1500
+#define ETHERNET_FRAME_MIN_SIZE 60 // without FCS
+#define ETHERNET_FRAME_MAX_SIZE (ETHERNET_MTU + 18) // header and VLAN tag, the chip strips the FCS
 
 /**
  * ----------------------------------------------------------------------------------------------------
  * Variables
  * ----------------------------------------------------------------------------------------------------
  */
+/* TX queue statistics */
+typedef struct
+{
+    uint32_t queue_depth;     // frames currently queued, including the one in flight
+    uint32_t queue_depth_max; // highest queue depth seen
+    uint32_t frames_sent;     // frames completed with SENDOK
+    uint32_t timeouts;        // frames completed with TIMEOUT
+    uint32_t stalls;          // times a sender had to wait for TX buffer space or a queue slot
+    uint64_t stall_time_us;   // total time senders spent waiting
+} w5x00_tx_stats_t;
 
 /**
  * ----------------------------------------------------------------------------------------------------
@@ -37,6 +49,11 @@
  *  \ingroup w5x00_lwip
  *
  *  It is used to send outgoing data to the socket.
+ *  The data is queued in the chip TX buffer and the function returns without
+ *  waiting for SENDOK, completion is reported through send_lwip_poll().
+ *  Assumes a single sender task, in practice the lwIP thread through the netif:
+ *  a frame is reserved, written and queued in separate steps, and only the
+ *  reserve and queue steps take the lock.
  *
  *  \param sn socket number
  *  \param buf a pointer to the data to send
@@ -45,6 +62,25 @@
  */
 int32_t send_lwip(uint8_t sn, uint8_t *buf, uint16_t len);
 
+/*! \brief complete sent packets
+ *  \ingroup w5x00_lwip
+ *
+ *  Checks the socket for SENDOK or TIMEOUT, retires the frame in flight and
+ *  starts the next queued one. Call it whenever INTn fires.
+ *
+ *  \param sn socket number
+ */
+void send_lwip_poll(uint8_t sn);
+
+/*! \brief get TX queue statistics
+ *  \ingroup w5x00_lwip
+ *
+ *  Copy the TX queue depth and stall counters.
+ *
+ *  \param stats a pointer to the structure to fill
+ */
+void send_lwip_get_stats(w5x00_tx_stats_t *stats);
+
 /*! \brief read an ethernet packet
  *  \ingroup w5x00_lwip
  *
@@ -57,6 +93,18 @@ int32_t send_lwip(uint8_t sn, uint8_t *buf, uint16_t len);
  */
 int32_t recv_lwip(uint8_t sn, uint8_t *buf, uint16_t len);
 
+/*! \brief read an ethernet packet into a pbuf chain
+ *  \ingroup w5x00_lwip
+ *
+ *  Allocates a PBUF_POOL chain sized for the next frame and reads the frame
+ *  from the socket straight into its payload segments, without a bounce buffer.
+ *  The caller must have checked that getSn_RX_RSR() is non-zero.
+ *
+ *  \param sn socket number
+ *  \return the received frame, or NULL if it was dropped
+ */
+struct pbuf *recv_lwip_pbuf(uint8_t sn);
+
 /*! \brief callback function
  *  \ingroup w5x00_lwip
  *
@@ -98,15 +146,4 @@ void netif_status_callback(struct netif *netif);
  */
 err_t netif_initialize(struct netif *netif);
 
-/*! \brief ethernet frame cyclic redundancy check
- *  \ingroup w5x00_lwip
- *
- *  Perform cyclic redundancy check on ethernet frame
- *
- *  \param data a pointer to the ethernet frame
- *  \param length the total length of ethernet frame
- *  \return an ethernet frame cyclic redundancy check result value
- */
-static uint32_t ethernet_frame_crc(const uint8_t *data, int length);
-
 #endif /* _W5x00_LWIP_H_ */
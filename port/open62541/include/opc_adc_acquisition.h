@@ -0,0 +1,139 @@
+#ifndef OPC_ADC_ACQUISITION_H
+#define OPC_ADC_ACQUISITION_H
+
+#include "open62541.h"
+#include <FreeRTOS.h>
+#include <task.h>
+#include <semphr.h>
+#include "adc_acquisition.h"
+#include "opc_external_value.h"
+
+/* Statistics shown under ADC, in firmware.model order */
+enum
+{
+    ADC_STATS_SAMPLE_RATE,
+    ADC_STATS_MEASURED_RATE,
+    ADC_STATS_OUTPUT_RATE,
+    ADC_STATS_BLOCKS,
+    ADC_STATS_ERRORS,
+    ADC_STATS_OVERRUNS,
+    ADC_STATS_COUNT
+};
+
+/* Written by ADC_Task, read by the server */
+static OpcExternalValue adcInputValues[ADC_ACQ_INPUT_COUNT];
+static OpcExternalValue adcStatsValues[ADC_STATS_COUNT];
+static UA_Boolean adcExternalValuesStarted = false;
+
+/* Woken after every round. Changed and used only under adcWakeupLock, so the server is not
+ * deleted while ADC_Task wakes it. */
+static SemaphoreHandle_t adcWakeupLock = NULL;
+static UA_Server *adcWakeupServer = NULL;
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Declarations
+ * ----------------------------------------------------------------------------------------------------
+ */
+static void startAdcExternalValues(UA_Server *server);
+
+static void stopAdcExternalValues(void);
+
+static void publishAdcValues(uint32_t inputs, void *context);
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Definitions
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Prepares the external values and hands them to ADC_Task, once for all users. New values
+ * wake the server, so that sampling does not wait for the loop timeout. */
+static void startAdcExternalValues(UA_Server *server)
+{
+    // Created before the listener is set, only the server task gets here
+    if (adcWakeupLock == NULL)
+    {
+        adcWakeupLock = xSemaphoreCreateMutex();
+    }
+
+    xSemaphoreTake(adcWakeupLock, portMAX_DELAY);
+    adcWakeupServer = server;
+    xSemaphoreGive(adcWakeupLock);
+
+    if (adcExternalValuesStarted)
+    {
+        return;
+    }
+    adcExternalValuesStarted = true;
+
+    for (uint32_t input = 0; input < ADC_ACQ_INPUT_COUNT; input++)
+    {
+        OpcExternalValue_init(&adcInputValues[input], &UA_TYPES[UA_TYPES_FLOAT]);
+    }
+
+    for (int field = 0; field < ADC_STATS_COUNT; field++)
+    {
+        OpcExternalValue_init(&adcStatsValues[field],
+                              (field < ADC_STATS_BLOCKS) ? &UA_TYPES[UA_TYPES_FLOAT] : &UA_TYPES[UA_TYPES_UINT32]);
+    }
+
+    adc_acquisition_set_listener(publishAdcValues, NULL);
+}
+
+/* Stops waking the server, call before it is deleted. The values keep being published. */
+static void stopAdcExternalValues(void)
+{
+    if (adcWakeupLock == NULL)
+    {
+        return;
+    }
+
+    xSemaphoreTake(adcWakeupLock, portMAX_DELAY);
+    adcWakeupServer = NULL;
+    xSemaphoreGive(adcWakeupLock);
+}
+
+/* Runs on ADC_Task after every round of outputs */
+static void publishAdcValues(uint32_t inputs, void *context)
+{
+    UA_DateTime now = UA_DateTime_now();
+    adc_acquisition_stats_t stats;
+    sensor_sample_t sample;
+
+    for (uint32_t input = 0; input < ADC_ACQ_INPUT_COUNT; input++)
+    {
+        const sensor_ring_t *ring = adc_acquisition_ring(input);
+
+        if (!(inputs & (1u << input)) || ring == NULL || !sensor_ring_latest(ring, &sample))
+        {
+            continue;
+        }
+
+        OpcExternalValue_publish(&adcInputValues[input], &sample.value, now,
+                                 (sample.status == SENSOR_STATUS_GOOD) ? UA_STATUSCODE_GOOD : UA_STATUSCODE_BADSENSORFAILURE);
+    }
+
+    adc_acquisition_get_stats(&stats);
+
+    UA_Float rates[] = {stats.sample_rate, stats.measured_rate, stats.output_rate};
+    UA_UInt32 counts[] = {stats.blocks, stats.errors, stats.overruns};
+
+    for (int field = 0; field < ADC_STATS_COUNT; field++)
+    {
+        const void *data = (field < ADC_STATS_BLOCKS) ? (const void *)&rates[field] : (const void *)&counts[field - ADC_STATS_BLOCKS];
+
+        OpcExternalValue_publish(&adcStatsValues[field], data, now, UA_STATUSCODE_GOOD);
+    }
+
+#ifdef UA_ENABLE_SERVER_WAKEUP
+    // Not a critical section, waking the server is a FreeRTOS call that may yield
+    xSemaphoreTake(adcWakeupLock, portMAX_DELAY);
+    if (adcWakeupServer != NULL)
+    {
+        UA_Server_wakeup(adcWakeupServer);
+    }
+    xSemaphoreGive(adcWakeupLock);
+#endif
+}
+
+#endif
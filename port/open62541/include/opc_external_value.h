@@ -0,0 +1,155 @@
+#ifndef OPC_EXTERNAL_VALUE_H
+#define OPC_EXTERNAL_VALUE_H
+
+#include "open62541.h"
+#include <FreeRTOS.h>
+#include <task.h>
+#include <string.h>
+
+typedef union
+{
+    UA_Boolean b;
+    UA_UInt32 u32;
+    UA_UInt64 u64;
+    UA_Float f;
+    UA_Double d;
+} OpcExternalValueData;
+
+/* Scalar value served through an external value backend. The producer writes the published
+ * copy between two increments of a sequence number. Before every read the server copies it
+ * into its own DataValue and retries while the sequence is odd or has changed, so reads never
+ * see a half written value and encode straight from the server copy without allocating. One
+ * producer per value, on any task. */
+typedef struct
+{
+    // Written by the producer
+    volatile uint32_t sequence;
+    OpcExternalValueData published;
+    UA_DateTime publishedTimestamp;
+    UA_StatusCode publishedStatus;
+
+    // Owned by the server task
+    UA_DataValue value;
+    OpcExternalValueData data;
+    UA_DataValue *current; // read by the server through the backend
+} OpcExternalValue;
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Declarations
+ * ----------------------------------------------------------------------------------------------------
+ */
+static void OpcExternalValue_init(OpcExternalValue *ev, const UA_DataType *type);
+
+static void OpcExternalValue_publish(OpcExternalValue *ev, const void *data,
+                                     UA_DateTime sourceTimestamp, UA_StatusCode status);
+
+static UA_StatusCode OpcExternalValue_notificationRead(UA_Server *server, const UA_NodeId *sessionId,
+                                                       void *sessionContext, const UA_NodeId *nodeId,
+                                                       void *nodeContext, const UA_NumericRange *range);
+
+static UA_StatusCode OpcExternalValue_attach(UA_Server *server, const UA_NodeId nodeId,
+                                             OpcExternalValue *ev);
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Definitions
+ * ----------------------------------------------------------------------------------------------------
+ */
+static void OpcExternalValue_init(OpcExternalValue *ev, const UA_DataType *type)
+{
+    memset(ev, 0, sizeof(OpcExternalValue));
+
+    ev->publishedStatus = UA_STATUSCODE_BADWAITINGFORINITIALDATA;
+
+    UA_DataValue_init(&ev->value);
+    UA_Variant_setScalar(&ev->value.value, &ev->data, type);
+    ev->value.value.storageType = UA_VARIANT_DATA_NODELETE;
+    ev->value.hasValue = true;
+    ev->value.status = ev->publishedStatus;
+    ev->value.hasStatus = true;
+
+    ev->current = &ev->value;
+}
+
+static void OpcExternalValue_publish(OpcExternalValue *ev, const void *data,
+                                     UA_DateTime sourceTimestamp, UA_StatusCode status)
+{
+    uint32_t sequence = ev->sequence;
+
+    // A reader on this core must not run while the sequence is odd, or it would retry forever
+    taskENTER_CRITICAL();
+
+    __atomic_store_n(&ev->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy(&ev->published, data, ev->value.value.type->memSize);
+    ev->publishedTimestamp = sourceTimestamp;
+    ev->publishedStatus = status;
+
+    // Make the copy complete before the sequence is even again
+    __atomic_store_n(&ev->sequence, sequence + 2, __ATOMIC_RELEASE);
+
+    taskEXIT_CRITICAL();
+}
+
+static UA_StatusCode OpcExternalValue_notificationRead(UA_Server *server, const UA_NodeId *sessionId,
+                                                       void *sessionContext, const UA_NodeId *nodeId,
+                                                       void *nodeContext, const UA_NumericRange *range)
+{
+    OpcExternalValue *ev = (OpcExternalValue *)nodeContext;
+    uint32_t sequence;
+    OpcExternalValueData data;
+    UA_DateTime sourceTimestamp;
+    UA_StatusCode status;
+
+    do
+    {
+        sequence = __atomic_load_n(&ev->sequence, __ATOMIC_ACQUIRE);
+
+        if (sequence & 1)
+        {
+            continue;
+        }
+
+        data = ev->published;
+        sourceTimestamp = ev->publishedTimestamp;
+        status = ev->publishedStatus;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((sequence & 1) || __atomic_load_n(&ev->sequence, __ATOMIC_RELAXED) != sequence);
+
+    // Nothing published yet, keep BadWaitingForInitialData without a timestamp
+    if (sequence == 0)
+    {
+        return UA_STATUSCODE_GOOD;
+    }
+
+    ev->data = data;
+    ev->value.sourceTimestamp = sourceTimestamp;
+    ev->value.hasSourceTimestamp = true;
+    ev->value.status = status;
+    ev->value.hasStatus = (status != UA_STATUSCODE_GOOD);
+
+    return UA_STATUSCODE_GOOD;
+}
+
+static UA_StatusCode OpcExternalValue_attach(UA_Server *server, const UA_NodeId nodeId,
+                                             OpcExternalValue *ev)
+{
+    UA_ValueBackend valueBackend;
+    memset(&valueBackend, 0, sizeof(UA_ValueBackend));
+    valueBackend.backendType = UA_VALUEBACKENDTYPE_EXTERNAL;
+    valueBackend.backend.external.value = &ev->current;
+    valueBackend.backend.external.callback.notificationRead = OpcExternalValue_notificationRead;
+
+    UA_StatusCode retval = UA_Server_setNodeContext(server, nodeId, ev);
+    if (retval != UA_STATUSCODE_GOOD)
+    {
+        return retval;
+    }
+
+    return UA_Server_setVariableNode_valueBackend(server, nodeId, valueBackend);
+}
+
+#endif
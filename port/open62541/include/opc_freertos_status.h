@@ -3,43 +3,118 @@
 
 #include "open62541.h"
 #include <FreeRTOS.h>
+#include <task.h>
 #include <stdio.h>
+#include "myMalloc.h"
+#include "opc_node_ids.h"
+
+/* Refresh period of the HeapStats snapshot, in ms */
+#ifndef OPC_HEAPSTATS_REFRESH_MS
+#define OPC_HEAPSTATS_REFRESH_MS 1000
+#endif
+
+/* Heap and realloc counters shown under HeapStats, in firmware.model order */
+static const char *heapStatsFields[] = {"xAvailableHeapSpaceInBytes", "xSizeOfLargestFreeBlockInBytes",
+                                        "xSizeOfSmallestFreeBlockInBytes", "xNumberOfFreeBlocks",
+                                        "xMinimumEverFreeBytesRemaining", "xNumberOfSuccessfulAllocations",
+                                        "xNumberOfSuccessfulFrees", "ulReallocInPlace", "ulReallocMoved",
+                                        "ulReallocBytesCopied"};
+
+/* Per-class slab counters shown under HeapStats.SlabN, in SlabStats_t order */
+static const char *slabStatsFields[] = {"xBlocksInUse", "xHighWater", "ulHits", "ulMisses"};
+
+#define HEAP_STATS_FIELD_COUNT (sizeof(heapStatsFields) / sizeof(heapStatsFields[0]))
+#define HEAP_STATS_SLAB_FIELD_COUNT (sizeof(slabStatsFields) / sizeof(slabStatsFields[0]))
+#define HEAP_STATS_VALUE_COUNT (HEAP_STATS_FIELD_COUNT + SLAB_CLASS_COUNT * HEAP_STATS_SLAB_FIELD_COUNT)
+
+/* Taken once per refresh period by a repeated callback. Every HeapStats read is served from
+ * here, so the heap free list is walked once per period however many clients poll. */
+typedef struct
+{
+    UA_UInt32 values[HEAP_STATS_VALUE_COUNT]; // heapStatsFields, then slabStatsFields per slab class
+    UA_DateTime sourceTimestamp;
+    UA_KeyValuePair pairs[HEAP_STATS_VALUE_COUNT]; // HeapStats.Snapshot, points into values
+    char slabKeys[SLAB_CLASS_COUNT * HEAP_STATS_SLAB_FIELD_COUNT][32];
+} HeapStatsSnapshot;
+
+static HeapStatsSnapshot heapStatsSnapshot;
+
+/* Sampling period of the task statistics, in ms */
+#ifndef OPC_TASKSTATS_REFRESH_MS
+#define OPC_TASKSTATS_REFRESH_MS 1000
+#endif
+
+/* Tasks tracked under TaskStats, further tasks are left out */
+#ifndef OPC_TASKSTATS_MAX_TASKS
+#define OPC_TASKSTATS_MAX_TASKS 16
+#endif
+
+/* Tasks one sample can hold. uxTaskGetSystemState() fills nothing unless every task fits, so
+ * this leaves room beyond the tracked ones; with more tasks the previous sample is kept. */
+#ifndef OPC_TASKSTATS_SAMPLE_TASKS
+#define OPC_TASKSTATS_SAMPLE_TASKS (2 * OPC_TASKSTATS_MAX_TASKS)
+#endif
+
+/* Per-task values shown under each task object, CpuLoad is a Float and the rest UInt32 */
+enum
+{
+    TASK_STATS_CPU_LOAD,
+    TASK_STATS_STATE,
+    TASK_STATS_CURRENT_PRIORITY,
+    TASK_STATS_BASE_PRIORITY,
+    TASK_STATS_RUN_TIME,
+    TASK_STATS_STACK_HIGH_WATER_MARK,
+    TASK_STATS_FIELD_COUNT
+};
+
+static const char *taskStatsFields[TASK_STATS_FIELD_COUNT] = {"CpuLoad", "eCurrentState", "uxCurrentPriority",
+                                                              "uxBasePriority", "ulRunTimeCounter",
+                                                              "usStackHighWaterMark"};
 
 typedef struct
 {
-    char name[40];    // Имя задачи
-    uint32_t runtime; // Время выполнения (в % или тиках)
-} TaskRuntimeInfo;
+    UBaseType_t xTaskNumber; // 0 when the slot is free
+    UA_Boolean seen;         // present in the latest sample
+    uint32_t ulLastRunTime;  // run time counter at the previous sample
+    UA_Float cpuLoad;        // percent of one core over the last period
+    UA_UInt32 values[TASK_STATS_FIELD_COUNT];
+} TaskStatsSlot;
+
+/* Filled by one uxTaskGetSystemState() call per period, nothing is allocated while sampling */
+static TaskStatus_t taskStatusBuffer[OPC_TASKSTATS_SAMPLE_TASKS];
+static UA_Boolean taskStatsOverflowLogged = false;
+static TaskStatsSlot taskStatsSlots[OPC_TASKSTATS_MAX_TASKS];
+static uint32_t taskStatsLastTotalRunTime = 0;
+static UA_DateTime taskStatsTimestamp = 0;
 
 /**
  * ----------------------------------------------------------------------------------------------------
  * Declarations
  * ----------------------------------------------------------------------------------------------------
  */
-static void addGetHeapStatsVariable(UA_Server *server);
-static void addValueCallbackToGetHeapStatsVariable(UA_Server *server);
-static void beforeWriteGetHeapStats(UA_Server *server,
-                                    const UA_NodeId *sessionId, void *sessionContext,
-                                    const UA_NodeId *nodeId, void *nodeContext,
-                                    const UA_NumericRange *range, const UA_DataValue *data);
-static void afterWriteGetHeapStats(UA_Server *server,
-                                   const UA_NodeId *sessionId, void *sessionContext,
-                                   const UA_NodeId *nodeid, void *nodeContext,
-                                   const UA_NumericRange *range, const UA_DataValue *data);
-static void updateGetHeapStatsNode(UA_Server *server);
-
-static void addTaskStatsFolder(UA_Server *server);
-static void addTaskStatsVariable(UA_Server *server, TaskHandle_t xTask);
-static void updateGetTaskStatsNode(UA_Server *server, const char *pcName);
-static void addValueCallbackToGetTaskStatsVariable(UA_Server *server, const char *pcName);
-static void beforeWriteGetTaskStats(UA_Server *server,
-                        const UA_NodeId *sessionId, void *sessionContext,
-                        const UA_NodeId *nodeid, void *nodeContext,
-                        const UA_NumericRange *range, const UA_DataValue *data);
-static void afterWriteGetTaskStats(UA_Server *server,
-                       const UA_NodeId *sessionId, void *sessionContext,
-                       const UA_NodeId *nodeId, void *nodeContext,
-                       const UA_NumericRange *range, const UA_DataValue *data);
+static void startHeapStatsRefresh(UA_Server *server);
+static void initHeapStatsSnapshot(void);
+static void refreshHeapStatsSnapshot(UA_Server *server, void *data);
+static UA_StatusCode readHeapStatsValue(UA_Server *server,
+                                        const UA_NodeId *sessionId, void *sessionContext,
+                                        const UA_NodeId *nodeId, void *nodeContext,
+                                        UA_Boolean sourceTimeStamp, const UA_NumericRange *range,
+                                        UA_DataValue *dataValue);
+static UA_StatusCode readHeapStatsSnapshot(UA_Server *server,
+                                           const UA_NodeId *sessionId, void *sessionContext,
+                                           const UA_NodeId *nodeId, void *nodeContext,
+                                           UA_Boolean sourceTimeStamp, const UA_NumericRange *range,
+                                           UA_DataValue *dataValue);
+
+static void startTaskStatsRefresh(UA_Server *server);
+static void addTaskStatsObject(UA_Server *server, size_t slot, const TaskStatus_t *pxStatus);
+static void removeTaskStatsObject(UA_Server *server, size_t slot);
+static void refreshTaskStats(UA_Server *server, void *data);
+static UA_StatusCode readTaskStatsValue(UA_Server *server,
+                                        const UA_NodeId *sessionId, void *sessionContext,
+                                        const UA_NodeId *nodeId, void *nodeContext,
+                                        UA_Boolean sourceTimeStamp, const UA_NumericRange *range,
+                                        UA_DataValue *dataValue);
 
 
 /**
@@ -47,446 +122,316 @@ static void afterWriteGetTaskStats(UA_Server *server,
  * vPortGetHeapStats
  * ----------------------------------------------------------------------------------------------------
  */
-static void addGetHeapStatsVariable(UA_Server *server)
+/* The HeapStats nodes come from firmware.model, this keeps their snapshot current */
+static void startHeapStatsRefresh(UA_Server *server)
 {
-    UA_ObjectTypeAttributes objTypeAttr = UA_ObjectTypeAttributes_default;
-    UA_VariableAttributes attr = UA_VariableAttributes_default;
-
-    objTypeAttr.displayName = UA_LOCALIZEDTEXT("en-US", "HeapStatsType");
-
-    UA_NodeId heapStatsTypeId = UA_NODEID_STRING(1, "HeapStatsType");
-    UA_Server_addObjectTypeNode(
-        server,
-        heapStatsTypeId,
-        UA_NODEID_NUMERIC(0, UA_NS0ID_BASEOBJECTTYPE),
-        UA_NODEID_NUMERIC(0, UA_NS0ID_HASSUBTYPE),
-        UA_QUALIFIEDNAME(1, "HeapStatsType"),
-        objTypeAttr,
-        NULL,
-        NULL);
-
-    UA_ObjectAttributes objAttr = UA_ObjectAttributes_default;
-    objAttr.displayName = UA_LOCALIZEDTEXT("en-US", "HeapStats");
-
-    UA_NodeId heapStatsObjId = UA_NODEID_STRING(1, "HeapStats");
-    UA_Server_addObjectNode(
-        server,
-        heapStatsObjId,
-        UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
-        UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
-        UA_QUALIFIEDNAME(1, "HeapStats"),
-        heapStatsTypeId,
-        objAttr,
-        NULL,
-        NULL);
-
-    // Добавляем переменные как компоненты объекта
-    UA_Server_addVariableNode(
-        server,
-        UA_NODEID_STRING(1, "HeapStats.xAvailableHeapSpaceInBytes"),
-        heapStatsObjId,
-        UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
-        UA_QUALIFIEDNAME(1, "xAvailableHeapSpaceInBytes"),
-        UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
-        attr,
-        NULL,
-        NULL);
-
-    UA_Server_addVariableNode(
-        server,
-        UA_NODEID_STRING(1, "HeapStats.xSizeOfLargestFreeBlockInBytes"),
-        heapStatsObjId,
-        UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
-        UA_QUALIFIEDNAME(1, "xSizeOfLargestFreeBlockInBytes"),
-        UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
-        attr,
-        NULL,
-        NULL);
-
-    UA_Server_addVariableNode(
-        server,
-        UA_NODEID_STRING(1, "HeapStats.xNumberOfFreeBlocks"),
-        heapStatsObjId,
-        UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
-        UA_QUALIFIEDNAME(1, "xNumberOfFreeBlocks"),
-        UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
-        attr,
-        NULL,
-        NULL);
-
-    UA_Server_addVariableNode(
-        server,
-        UA_NODEID_STRING(1, "HeapStats.xMinimumEverFreeBytesRemaining"),
-        heapStatsObjId,
-        UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
-        UA_QUALIFIEDNAME(1, "xMinimumEverFreeBytesRemaining"),
-        UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
-        attr,
-        NULL,
-        NULL);
-
-    UA_Server_addVariableNode(
-        server,
-        UA_NODEID_STRING(1, "HeapStats.xNumberOfSuccessfulAllocations"),
-        heapStatsObjId,
-        UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
-        UA_QUALIFIEDNAME(1, "xNumberOfSuccessfulAllocations"),
-        UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
-        attr,
-        NULL,
-        NULL);
-
-    UA_Server_addVariableNode(
-        server,
-        UA_NODEID_STRING(1, "HeapStats.xNumberOfSuccessfulFrees"),
-        heapStatsObjId,
-        UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
-        UA_QUALIFIEDNAME(1, "xNumberOfSuccessfulFrees"),
-        UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
-        attr,
-        NULL,
-        NULL);
-
-    updateGetHeapStatsNode(server);
-
-    addValueCallbackToGetHeapStatsVariable(server);
+    refreshHeapStatsSnapshot(server, NULL);
+    UA_Server_addRepeatedCallback(server, refreshHeapStatsSnapshot, NULL, OPC_HEAPSTATS_REFRESH_MS, NULL);
 }
 
-static void updateGetHeapStatsNode(UA_Server *server)
+/* Points the snapshot pairs at their keys and values, the refresh only updates the values */
+static void initHeapStatsSnapshot(void)
 {
-    HeapStats_t pxHeapStats;
-    vPortGetHeapStats(&pxHeapStats);
-
-    // AvailableHeapSpace
-    UA_Variant heapAvailablevalue;
-    UA_UInt32 heapAvailable = (UA_UInt32)pxHeapStats.xAvailableHeapSpaceInBytes;
-    UA_Variant_setScalar(&heapAvailablevalue, &heapAvailable, &UA_TYPES[UA_TYPES_UINT32]);
-    UA_NodeId nodeAvailable = UA_NODEID_STRING(1, "HeapStats.xAvailableHeapSpaceInBytes");
-    UA_Server_writeValue(server, nodeAvailable, heapAvailablevalue);
-
-    // SizeOfLargestFreeBlockInBytes
-    UA_Variant largestBlockvalue;
-    UA_UInt32 largestBlock = (UA_UInt32)pxHeapStats.xSizeOfLargestFreeBlockInBytes;
-    UA_Variant_setScalar(&largestBlockvalue, &largestBlock, &UA_TYPES[UA_TYPES_UINT32]);
-    UA_NodeId nodeLargestBlock = UA_NODEID_STRING(1, "HeapStats.xSizeOfLargestFreeBlockInBytes");
-    UA_Server_writeValue(server, nodeLargestBlock, largestBlockvalue);
-
-    // SizeOfSmallestFreeBlockInBytes
-    UA_Variant SmallestBlockvalue;
-    UA_UInt32 SmallestFreeBlock = (UA_UInt32)pxHeapStats.xSizeOfSmallestFreeBlockInBytes;
-    UA_Variant_setScalar(&SmallestBlockvalue, &SmallestFreeBlock, &UA_TYPES[UA_TYPES_UINT32]);
-    UA_NodeId nodeSmallestFreeBlock = UA_NODEID_STRING(1, "HeapStats.xSizeOfSmallestFreeBlockInBytes");
-    UA_Server_writeValue(server, nodeSmallestFreeBlock, SmallestBlockvalue);
-
-    // NumberOfFreeBlocks
-    UA_Variant freeBlocksvalue;
-    UA_UInt32 freeBlocks = (UA_UInt32)pxHeapStats.xNumberOfFreeBlocks;
-    UA_Variant_setScalar(&freeBlocksvalue, &freeBlocks, &UA_TYPES[UA_TYPES_UINT32]);
-    UA_NodeId nodeFreeBlocks = UA_NODEID_STRING(1, "HeapStats.xNumberOfFreeBlocks");
-    UA_Server_writeValue(server, nodeFreeBlocks, freeBlocksvalue);
-
-    // MinimumEverFreeBytesRemaining
-    UA_Variant EverFreeBytesvalue;
-    UA_UInt32 EverFreeBytes = (UA_UInt32)pxHeapStats.xMinimumEverFreeBytesRemaining;
-    UA_Variant_setScalar(&EverFreeBytesvalue, &EverFreeBytes, &UA_TYPES[UA_TYPES_UINT32]);
-    UA_NodeId nodeEverFreeBytes = UA_NODEID_STRING(1, "HeapStats.xMinimumEverFreeBytesRemaining");
-    UA_Server_writeValue(server, nodeEverFreeBytes, EverFreeBytesvalue);
-
-    // NumberOfSuccessfulAllocations
-    UA_Variant SuccessAllocationvalue;
-    UA_UInt32 SuccessAllocation = (UA_UInt32)pxHeapStats.xNumberOfSuccessfulAllocations;
-    UA_Variant_setScalar(&SuccessAllocationvalue, &SuccessAllocation, &UA_TYPES[UA_TYPES_UINT32]);
-    UA_NodeId nodeSuccessAllocation = UA_NODEID_STRING(1, "HeapStats.xNumberOfSuccessfulAllocations");
-    UA_Server_writeValue(server, nodeSuccessAllocation, SuccessAllocationvalue);
-
-    // NumberOfSuccessfulFrees
-    UA_Variant SuccessfulFreesvalue;
-    UA_UInt32 SuccessfulFrees = (UA_UInt32)pxHeapStats.xNumberOfSuccessfulFrees;
-    UA_Variant_setScalar(&SuccessfulFreesvalue, &SuccessfulFrees, &UA_TYPES[UA_TYPES_UINT32]);
-    UA_NodeId nodeSuccessfulFrees = UA_NODEID_STRING(1, "HeapStats.xNumberOfSuccessfulFrees");
-    UA_Server_writeValue(server, nodeSuccessfulFrees, SuccessfulFreesvalue);
+    SlabStats_t xSlabStats[SLAB_CLASS_COUNT];
+    vPortGetSlabStats(xSlabStats);
+
+    memset(&heapStatsSnapshot, 0, sizeof(heapStatsSnapshot));
+
+    for (size_t i = 0; i < HEAP_STATS_VALUE_COUNT; i++)
+    {
+        UA_KeyValuePair *pair = &heapStatsSnapshot.pairs[i];
+        const char *key = heapStatsFields[i];
+
+        if (i >= HEAP_STATS_FIELD_COUNT)
+        {
+            size_t slab = (i - HEAP_STATS_FIELD_COUNT) / HEAP_STATS_SLAB_FIELD_COUNT;
+            size_t field = (i - HEAP_STATS_FIELD_COUNT) % HEAP_STATS_SLAB_FIELD_COUNT;
+            char *slabKey = heapStatsSnapshot.slabKeys[i - HEAP_STATS_FIELD_COUNT];
+
+            snprintf(slabKey, sizeof(heapStatsSnapshot.slabKeys[0]), "Slab%u.%s",
+                     (unsigned int)xSlabStats[slab].xBlockSize, slabStatsFields[field]);
+            key = slabKey;
+        }
+
+        pair->key = UA_QUALIFIEDNAME(1, (char *)key);
+        UA_Variant_setScalar(&pair->value, &heapStatsSnapshot.values[i], &UA_TYPES[UA_TYPES_UINT32]);
+        pair->value.storageType = UA_VARIANT_DATA_NODELETE;
+    }
 }
 
-static void
-beforeWriteGetHeapStats(UA_Server *server,
-                        const UA_NodeId *sessionId, void *sessionContext,
-                        const UA_NodeId *nodeid, void *nodeContext,
-                        const UA_NumericRange *range, const UA_DataValue *data)
+static void refreshHeapStatsSnapshot(UA_Server *server, void *data)
 {
-    updateGetHeapStatsNode(server);
+    HeapStats_t xHeapStats;
+    ReallocStats_t xReallocStats;
+    SlabStats_t xSlabStats[SLAB_CLASS_COUNT];
+    UA_UInt32 *values = heapStatsSnapshot.values;
+
+    vPortGetHeapStats(&xHeapStats);
+    vPortGetReallocStats(&xReallocStats);
+    vPortGetSlabStats(xSlabStats);
+
+    // heapStatsFields order
+    values[0] = (UA_UInt32)xHeapStats.xAvailableHeapSpaceInBytes;
+    values[1] = (UA_UInt32)xHeapStats.xSizeOfLargestFreeBlockInBytes;
+    values[2] = (UA_UInt32)xHeapStats.xSizeOfSmallestFreeBlockInBytes;
+    values[3] = (UA_UInt32)xHeapStats.xNumberOfFreeBlocks;
+    values[4] = (UA_UInt32)xHeapStats.xMinimumEverFreeBytesRemaining;
+    values[5] = (UA_UInt32)xHeapStats.xNumberOfSuccessfulAllocations;
+    values[6] = (UA_UInt32)xHeapStats.xNumberOfSuccessfulFrees;
+    values[7] = xReallocStats.ulInPlace;
+    values[8] = xReallocStats.ulMoved;
+    values[9] = xReallocStats.ulBytesCopied;
+
+    // slabStatsFields order
+    values += HEAP_STATS_FIELD_COUNT;
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++)
+    {
+        *values++ = (UA_UInt32)xSlabStats[i].xBlocksInUse;
+        *values++ = (UA_UInt32)xSlabStats[i].xHighWater;
+        *values++ = (UA_UInt32)xSlabStats[i].ulHits;
+        *values++ = (UA_UInt32)xSlabStats[i].ulMisses;
+    }
+
+    heapStatsSnapshot.sourceTimestamp = UA_DateTime_now();
 }
 
-static void
-afterWriteGetHeapStats(UA_Server *server,
-                       const UA_NodeId *sessionId, void *sessionContext,
-                       const UA_NodeId *nodeId, void *nodeContext,
-                       const UA_NumericRange *range, const UA_DataValue *data)
+static UA_StatusCode
+readHeapStatsValue(UA_Server *server,
+                   const UA_NodeId *sessionId, void *sessionContext,
+                   const UA_NodeId *nodeId, void *nodeContext,
+                   UA_Boolean sourceTimeStamp, const UA_NumericRange *range,
+                   UA_DataValue *dataValue)
 {
+    size_t index = (size_t)(uintptr_t)nodeContext;
+
+    if (index >= HEAP_STATS_VALUE_COUNT)
+    {
+        return UA_STATUSCODE_BADINTERNALERROR;
+    }
+
+    UA_Variant_setScalarCopy(&dataValue->value, &heapStatsSnapshot.values[index], &UA_TYPES[UA_TYPES_UINT32]);
+    dataValue->hasValue = true;
+    if (sourceTimeStamp)
+    {
+        dataValue->sourceTimestamp = heapStatsSnapshot.sourceTimestamp;
+        dataValue->hasSourceTimestamp = true;
+    }
+    return UA_STATUSCODE_GOOD;
 }
 
-static void
-addValueCallbackToGetHeapStatsVariable(UA_Server *server)
+static UA_StatusCode
+readHeapStatsSnapshot(UA_Server *server,
+                      const UA_NodeId *sessionId, void *sessionContext,
+                      const UA_NodeId *nodeId, void *nodeContext,
+                      UA_Boolean sourceTimeStamp, const UA_NumericRange *range,
+                      UA_DataValue *dataValue)
 {
-    UA_NodeId currentNodeId = UA_NODEID_STRING(1, "HeapStats.xAvailableHeapSpaceInBytes");
-    UA_ValueCallback callback;
-    callback.onRead = beforeWriteGetHeapStats;
-    callback.onWrite = afterWriteGetHeapStats;
-    UA_Server_setVariableNode_valueCallback(server, currentNodeId, callback);
+    // Handed out by reference, the server copies it into the response
+    UA_Variant_setArray(&dataValue->value, heapStatsSnapshot.pairs, HEAP_STATS_VALUE_COUNT,
+                        &UA_TYPES[UA_TYPES_KEYVALUEPAIR]);
+    dataValue->value.storageType = UA_VARIANT_DATA_NODELETE;
+    dataValue->hasValue = true;
+    if (sourceTimeStamp)
+    {
+        dataValue->sourceTimestamp = heapStatsSnapshot.sourceTimestamp;
+        dataValue->hasSourceTimestamp = true;
+    }
+    return UA_STATUSCODE_GOOD;
 }
 
 /**
  * ----------------------------------------------------------------------------------------------------
- * vTaskGetInfo
+ * uxTaskGetSystemState
  * ----------------------------------------------------------------------------------------------------
  */
-static void addTaskStatsFolder(UA_Server *server)
+/* The TaskStats folder and type come from firmware.model, the task objects below are added
+ * and removed here as tasks come and go */
+static void startTaskStatsRefresh(UA_Server *server)
 {
-    UA_NodeId taskStatsFolderId = UA_NODEID_STRING(1, "TaskStats");
-    UA_ObjectAttributes folderAttr = UA_ObjectAttributes_default;
-    folderAttr.displayName = UA_LOCALIZEDTEXT("en-US", "Task Statistics");
+    // A new server has none of the task objects of the previous one
+    memset(taskStatsSlots, 0, sizeof(taskStatsSlots));
+    taskStatsLastTotalRunTime = 0;
 
-    UA_Server_addObjectNode(
-        server,
-        taskStatsFolderId,
-        UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
-        UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
-        UA_QUALIFIEDNAME(1, "TaskStats"),
-        UA_NODEID_NUMERIC(0, UA_NS0ID_FOLDERTYPE),
-        folderAttr,
-        NULL,
-        NULL);
+    refreshTaskStats(server, NULL);
+    UA_Server_addRepeatedCallback(server, refreshTaskStats, NULL, OPC_TASKSTATS_REFRESH_MS, NULL);
 }
 
-static void addTaskStatsVariable(UA_Server *server, TaskHandle_t xTask)
+/* Samples every task, updates the slots and adds or removes task objects as tasks come and go */
+static void refreshTaskStats(UA_Server *server, void *data)
 {
-    UA_ObjectTypeAttributes objTypeAttr = UA_ObjectTypeAttributes_default;
-
-    TaskStatus_t xTaskStatus;
-    vTaskGetInfo(xTask, &xTaskStatus, pdTRUE, eInvalid);
-
-    objTypeAttr.displayName = UA_LOCALIZEDTEXT("en-US", "TaskStatsType");
-
-    UA_NodeId taskStatsTypeId = UA_NODEID_STRING(1, "TaskStatsType");
-    UA_Server_addObjectTypeNode(
-        server,
-        taskStatsTypeId,
-        UA_NODEID_NUMERIC(0, UA_NS0ID_BASEOBJECTTYPE),
-        UA_NODEID_NUMERIC(0, UA_NS0ID_HASSUBTYPE),
-        UA_QUALIFIEDNAME(1, "TaskStatsType"),
-        objTypeAttr,
-        NULL,
-        NULL);
+    configRUN_TIME_COUNTER_TYPE ulTotalRunTime;
+    UBaseType_t uxTasks = uxTaskGetNumberOfTasks();
+
+    if (uxTasks > OPC_TASKSTATS_SAMPLE_TASKS)
+    {
+        // Keep the previous sample until tasks are deleted again
+        if (!taskStatsOverflowLogged)
+        {
+            UA_LOG_WARNING(UA_Log_Stdout, UA_LOGCATEGORY_SERVER,
+                           "TaskStats: %u tasks exceed OPC_TASKSTATS_SAMPLE_TASKS (%u), not updated",
+                           (unsigned int)uxTasks, (unsigned int)OPC_TASKSTATS_SAMPLE_TASKS);
+            taskStatsOverflowLogged = true;
+        }
+        return;
+    }
+    taskStatsOverflowLogged = false;
+
+    UBaseType_t uxCount = uxTaskGetSystemState(taskStatusBuffer, OPC_TASKSTATS_SAMPLE_TASKS, &ulTotalRunTime);
+    uint32_t ulTotalDelta = (uint32_t)ulTotalRunTime - taskStatsLastTotalRunTime;
+
+    if (uxCount == 0)
+    {
+        // A task was created since it was counted, the next period catches up
+        return;
+    }
+    taskStatsLastTotalRunTime = (uint32_t)ulTotalRunTime;
+    taskStatsTimestamp = UA_DateTime_now();
+
+    for (size_t i = 0; i < OPC_TASKSTATS_MAX_TASKS; i++)
+    {
+        taskStatsSlots[i].seen = false;
+    }
+
+    for (UBaseType_t i = 0; i < uxCount; i++)
+    {
+        const TaskStatus_t *pxStatus = &taskStatusBuffer[i];
+        TaskStatsSlot *pxSlot = NULL;
+        size_t freeSlot = OPC_TASKSTATS_MAX_TASKS;
+
+        for (size_t j = 0; j < OPC_TASKSTATS_MAX_TASKS; j++)
+        {
+            if (taskStatsSlots[j].xTaskNumber == pxStatus->xTaskNumber)
+            {
+                pxSlot = &taskStatsSlots[j];
+                break;
+            }
+            if (taskStatsSlots[j].xTaskNumber == 0 && freeSlot == OPC_TASKSTATS_MAX_TASKS)
+            {
+                freeSlot = j;
+            }
+        }
+
+        if (pxSlot == NULL)
+        {
+            if (freeSlot == OPC_TASKSTATS_MAX_TASKS)
+            {
+                continue;
+            }
+            pxSlot = &taskStatsSlots[freeSlot];
+            pxSlot->xTaskNumber = pxStatus->xTaskNumber;
+            pxSlot->ulLastRunTime = (uint32_t)pxStatus->ulRunTimeCounter;
+            pxSlot->cpuLoad = 0.0f;
+            addTaskStatsObject(server, freeSlot, pxStatus);
+        }
+        else if (ulTotalDelta > 0)
+        {
+            uint32_t ulTaskDelta = (uint32_t)pxStatus->ulRunTimeCounter - pxSlot->ulLastRunTime;
+            pxSlot->cpuLoad = 100.0f * (UA_Float)ulTaskDelta / (UA_Float)ulTotalDelta;
+        }
+
+        pxSlot->seen = true;
+        pxSlot->ulLastRunTime = (uint32_t)pxStatus->ulRunTimeCounter;
+        pxSlot->values[TASK_STATS_STATE] = (UA_UInt32)pxStatus->eCurrentState;
+        pxSlot->values[TASK_STATS_CURRENT_PRIORITY] = (UA_UInt32)pxStatus->uxCurrentPriority;
+        pxSlot->values[TASK_STATS_BASE_PRIORITY] = (UA_UInt32)pxStatus->uxBasePriority;
+        pxSlot->values[TASK_STATS_RUN_TIME] = (UA_UInt32)pxStatus->ulRunTimeCounter;
+        pxSlot->values[TASK_STATS_STACK_HIGH_WATER_MARK] = (UA_UInt32)pxStatus->usStackHighWaterMark;
+    }
+
+    for (size_t i = 0; i < OPC_TASKSTATS_MAX_TASKS; i++)
+    {
+        if (taskStatsSlots[i].xTaskNumber != 0 && !taskStatsSlots[i].seen)
+        {
+            removeTaskStatsObject(server, i);
+        }
+    }
+}
 
+static void addTaskStatsObject(UA_Server *server, size_t slot, const TaskStatus_t *pxStatus)
+{
     UA_ObjectAttributes objAttr = UA_ObjectAttributes_default;
-    objAttr.displayName = UA_LOCALIZEDTEXT("en-US", xTaskStatus.pcTaskName);
+    UA_VariableAttributes attr = UA_VariableAttributes_default;
 
-    UA_NodeId taskObjId = UA_NODEID_STRING(1, xTaskStatus.pcTaskName);
-    UA_NodeId folderId = UA_NODEID_STRING(1, "TaskStats");
+    objAttr.displayName = UA_LOCALIZEDTEXT("en-US", (char *)pxStatus->pcTaskName);
+
+    // Task names need not be unique, task numbers are
+    UA_UInt32 taskId = OPC_ID_TASKSTATS_TASK + (UA_UInt32)pxStatus->xTaskNumber * OPC_ID_TASKSTATS_STRIDE;
+    UA_NodeId taskObjId = OPC_NODEID(taskId);
     UA_Server_addObjectNode(
         server,
         taskObjId,
-        folderId,
+        OPC_NODEID(OPC_ID_TASKSTATS),
         UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
-        UA_QUALIFIEDNAME(1, xTaskStatus.pcTaskName),
-        taskStatsTypeId,
+        UA_QUALIFIEDNAME(1, (char *)pxStatus->pcTaskName),
+        OPC_NODEID(OPC_ID_TASKSTATS_TYPE),
         objAttr,
         NULL,
         NULL);
 
-    UA_VariableAttributes attr = UA_VariableAttributes_default;
-    char id[50];
-
-    snprintf(id, sizeof(id), "%s.%s", xTaskStatus.pcTaskName, "xTaskNumber");
-    UA_Server_addVariableNode(
-        server,
-        UA_NODEID_STRING(1, id),
-        taskObjId,
-        UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
-        UA_QUALIFIEDNAME(1, "xTaskNumber"),
-        UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
-        attr,
-        NULL,
-        NULL);
-
-    snprintf(id, sizeof(id), "%s.%s", xTaskStatus.pcTaskName, "eCurrentState");
-    UA_Server_addVariableNode(
-        server,
-        UA_NODEID_STRING(1, id),
-        taskObjId,
-        UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
-        UA_QUALIFIEDNAME(1, "eCurrentState"),
-        UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
-        attr,
-        NULL,
-        NULL);
-
-    snprintf(id, sizeof(id), "%s.%s", xTaskStatus.pcTaskName, "uxCurrentPriority");
-    UA_Server_addVariableNode(
-        server,
-        UA_NODEID_STRING(1, id),
-        taskObjId,
-        UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
-        UA_QUALIFIEDNAME(1, "uxCurrentPriority"),
-        UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
-        attr,
-        NULL,
-        NULL);
-
-    snprintf(id, sizeof(id), "%s.%s", xTaskStatus.pcTaskName, "uxBasePriority");
-    UA_Server_addVariableNode(
-        server,
-        UA_NODEID_STRING(1, id),
-        taskObjId,
-        UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
-        UA_QUALIFIEDNAME(1, "uxBasePriority"),
-        UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
-        attr,
-        NULL,
-        NULL);
-
-    snprintf(id, sizeof(id), "%s.%s", xTaskStatus.pcTaskName, "ulRunTimeCounter");
-    UA_Server_addVariableNode(
-        server,
-        UA_NODEID_STRING(1, id),
-        taskObjId,
-        UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
-        UA_QUALIFIEDNAME(1, "ulRunTimeCounter"),
-        UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
-        attr,
-        NULL,
-        NULL);
-
-    snprintf(id, sizeof(id), "%s.%s", xTaskStatus.pcTaskName, "pxStackBase");
-    UA_Server_addVariableNode(
-        server,
-        UA_NODEID_STRING(1, id),
-        taskObjId,
-        UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
-        UA_QUALIFIEDNAME(1, "pxStackBase"),
-        UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
-        attr,
-        NULL,
-        NULL);
-
-    snprintf(id, sizeof(id), "%s.%s", xTaskStatus.pcTaskName, "usStackHighWaterMark");
-    UA_Server_addVariableNode(
-        server,
-        UA_NODEID_STRING(1, id),
-        taskObjId,
-        UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
-        UA_QUALIFIEDNAME(1, "usStackHighWaterMark"),
-        UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
-        attr,
-        NULL,
-        NULL);
-
-    updateGetTaskStatsNode(server, xTaskStatus.pcTaskName);
-
-    addValueCallbackToGetTaskStatsVariable(server, xTaskStatus.pcTaskName);
+    UA_DataSource taskSource;
+    taskSource.read = readTaskStatsValue;
+    taskSource.write = NULL;
+    attr.accessLevel = UA_ACCESSLEVELMASK_READ;
+
+    for (int field = 0; field < TASK_STATS_FIELD_COUNT; field++)
+    {
+        attr.displayName = UA_LOCALIZEDTEXT("en-US", (char *)taskStatsFields[field]);
+        attr.dataType = (field == TASK_STATS_CPU_LOAD) ? UA_TYPES[UA_TYPES_FLOAT].typeId : UA_TYPES[UA_TYPES_UINT32].typeId;
+
+        UA_Server_addDataSourceVariableNode(
+            server,
+            OPC_NODEID(taskId + 1 + field),
+            taskObjId,
+            UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+            UA_QUALIFIEDNAME(1, (char *)taskStatsFields[field]),
+            UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
+            attr,
+            taskSource,
+            (void *)(uintptr_t)(slot * TASK_STATS_FIELD_COUNT + field),
+            NULL);
+    }
 }
 
-static void updateGetTaskStatsNode(UA_Server *server, const char *pcName)
+static void removeTaskStatsObject(UA_Server *server, size_t slot)
 {
-    TaskStatus_t xTaskStatus;
-    TaskHandle_t xTask = xTaskGetHandle(pcName);
-    vTaskGetInfo(xTask, &xTaskStatus, pdTRUE, eInvalid);
-
-    UA_Variant value;
-    UA_NodeId nodeId;
-
-    char id[50];
-
-    // xTaskNumber
-    UA_Variant xTaskNumbervalue;
-    UA_UInt32 xTaskNumber = (UA_UInt32)xTaskStatus.xTaskNumber;
-    UA_Variant_setScalar(&xTaskNumbervalue, &xTaskNumber, &UA_TYPES[UA_TYPES_UINT32]);
-    snprintf(id, sizeof(id), "%s.%s", xTaskStatus.pcTaskName, "xTaskNumber");
-    nodeId = UA_NODEID_STRING(1, id);
-    UA_Server_writeValue(server, nodeId, xTaskNumbervalue);
-
-    // xTaskNumber
-    UA_Variant eCurrentStatevalue;
-    UA_UInt32 eCurrentState = (UA_UInt32)xTaskStatus.eCurrentState;
-    UA_Variant_setScalar(&eCurrentStatevalue, &eCurrentState, &UA_TYPES[UA_TYPES_UINT32]);
-    snprintf(id, sizeof(id), "%s.%s", xTaskStatus.pcTaskName, "eCurrentState");
-    nodeId = UA_NODEID_STRING(1, id);
-    UA_Server_writeValue(server, nodeId, eCurrentStatevalue);
-
-    // uxCurrentPriority
-    UA_Variant uxCurrentPriorityvalue;
-    UA_UInt32 uxCurrentPriority = (UA_UInt32)xTaskStatus.uxCurrentPriority;
-    UA_Variant_setScalar(&uxCurrentPriorityvalue, &uxCurrentPriority, &UA_TYPES[UA_TYPES_UINT32]);
-    snprintf(id, sizeof(id), "%s.%s", xTaskStatus.pcTaskName, "uxCurrentPriority");
-    nodeId = UA_NODEID_STRING(1, id);
-    UA_Server_writeValue(server, nodeId, uxCurrentPriorityvalue);
-
-    // uxBasePriority
-    UA_Variant uxBasePriorityvalue;
-    UA_UInt32 uxBasePriority = (UA_UInt32)xTaskStatus.uxBasePriority;
-    UA_Variant_setScalar(&uxBasePriorityvalue, &uxBasePriority, &UA_TYPES[UA_TYPES_UINT32]);
-    snprintf(id, sizeof(id), "%s.%s", xTaskStatus.pcTaskName, "uxBasePriority");
-    nodeId = UA_NODEID_STRING(1, id);
-    UA_Server_writeValue(server, nodeId, uxBasePriorityvalue);
-
-    // ulRunTimeCounter
-    UA_Variant ulRunTimeCountervalue;
-    UA_UInt32 ulRunTimeCounter = (UA_UInt32)xTaskStatus.ulRunTimeCounter;
-    UA_Variant_setScalar(&ulRunTimeCountervalue, &ulRunTimeCounter, &UA_TYPES[UA_TYPES_UINT32]);
-    snprintf(id, sizeof(id), "%s.%s", xTaskStatus.pcTaskName, "ulRunTimeCounter");
-    nodeId = UA_NODEID_STRING(1, id);
-    UA_Server_writeValue(server, nodeId, ulRunTimeCountervalue);
-
-    // pxStackBase
-    UA_Variant pxStackBasevalue;
-    UA_UInt32 pxStackBase = (UA_UInt32)xTaskStatus.pxStackBase;
-    UA_Variant_setScalar(&pxStackBasevalue, &pxStackBase, &UA_TYPES[UA_TYPES_UINT32]);
-    snprintf(id, sizeof(id), "%s.%s", xTaskStatus.pcTaskName, "pxStackBase");
-    nodeId = UA_NODEID_STRING(1, id);
-    UA_Server_writeValue(server, nodeId, pxStackBasevalue);
-
-    // usStackHighWaterMark
-    UA_Variant usStackHighWaterMarkvalue;
-    UA_UInt32 usStackHighWaterMark = (UA_UInt32)xTaskStatus.usStackHighWaterMark;
-    UA_Variant_setScalar(&usStackHighWaterMarkvalue, &usStackHighWaterMark, &UA_TYPES[UA_TYPES_UINT32]);
-    snprintf(id, sizeof(id), "%s.%s", xTaskStatus.pcTaskName, "usStackHighWaterMark");
-    nodeId = UA_NODEID_STRING(1, id);
-    UA_Server_writeValue(server, nodeId, usStackHighWaterMarkvalue);
-
-    UA_Variant_clear(&value);
-}
+    UA_UInt32 taskId = OPC_ID_TASKSTATS_TASK + (UA_UInt32)taskStatsSlots[slot].xTaskNumber * OPC_ID_TASKSTATS_STRIDE;
 
-static void
-beforeWriteGetTaskStats(UA_Server *server,
-                        const UA_NodeId *sessionId, void *sessionContext,
-                        const UA_NodeId *nodeid, void *nodeContext,
-                        const UA_NumericRange *range, const UA_DataValue *data)
-{
-    char id[50];
-    memcpy(id, nodeid->identifier.string.data, nodeid->identifier.string.length + 1);
-    id[nodeid->identifier.string.length] = '\0';
-    char *pcName = strtok(id, ".");
-    updateGetTaskStatsNode(server, pcName);
-}
+    // The variables go with the object
+    UA_Server_deleteNode(server, OPC_NODEID(taskId), true);
 
-static void
-afterWriteGetTaskStats(UA_Server *server,
-                       const UA_NodeId *sessionId, void *sessionContext,
-                       const UA_NodeId *nodeId, void *nodeContext,
-                       const UA_NumericRange *range, const UA_DataValue *data)
-{
+    memset(&taskStatsSlots[slot], 0, sizeof(TaskStatsSlot));
 }
 
-static void
-addValueCallbackToGetTaskStatsVariable(UA_Server *server, const char *pcName)
+static UA_StatusCode
+readTaskStatsValue(UA_Server *server,
+                   const UA_NodeId *sessionId, void *sessionContext,
+                   const UA_NodeId *nodeId, void *nodeContext,
+                   UA_Boolean sourceTimeStamp, const UA_NumericRange *range,
+                   UA_DataValue *dataValue)
 {
-    char id[50];
-    snprintf(id, sizeof(id), "%s.%s", pcName, "xTaskNumber");
-    UA_NodeId currentNodeId = UA_NODEID_STRING(1, id);
-
-    UA_ValueCallback callback;
-    callback.onRead = beforeWriteGetTaskStats;
-    callback.onWrite = afterWriteGetTaskStats;
-    UA_Server_setVariableNode_valueCallback(server, currentNodeId, callback);
+    size_t slot = (size_t)(uintptr_t)nodeContext / TASK_STATS_FIELD_COUNT;
+    int field = (int)((size_t)(uintptr_t)nodeContext % TASK_STATS_FIELD_COUNT);
+
+    if (slot >= OPC_TASKSTATS_MAX_TASKS)
+    {
+        return UA_STATUSCODE_BADINTERNALERROR;
+    }
+
+    if (field == TASK_STATS_CPU_LOAD)
+    {
+        UA_Variant_setScalarCopy(&dataValue->value, &taskStatsSlots[slot].cpuLoad, &UA_TYPES[UA_TYPES_FLOAT]);
+    }
+    else
+    {
+        UA_Variant_setScalarCopy(&dataValue->value, &taskStatsSlots[slot].values[field], &UA_TYPES[UA_TYPES_UINT32]);
+    }
+    dataValue->hasValue = true;
+    if (sourceTimeStamp)
+    {
+        dataValue->sourceTimestamp = taskStatsTimestamp;
+        dataValue->hasSourceTimestamp = true;
+    }
+    return UA_STATUSCODE_GOOD;
 }
 
-#endif // !OPC_FREERTOS_STATUS_H
\ No newline at end of file
+#endif // !OPC_FREERTOS_STATUS_H
@@ -0,0 +1,228 @@
+#ifndef OPC_MODEL_H
+#define OPC_MODEL_H
+
+#include "open62541.h"
+#include <stdio.h>
+#include "opc_node_ids.h"
+#include "opc_external_value.h"
+#include "opc_add_temperature.h"
+#include "opc_adc_acquisition.h"
+#include "opc_freertos_status.h"
+
+/* Where a model variable takes its value from, named in firmware.model as value=<source>:<index> */
+typedef enum
+{
+    OPC_MODEL_VALUE_NONE,
+    OPC_MODEL_VALUE_ADC_INPUT,          // external value adcInputValues[index]
+    OPC_MODEL_VALUE_ADC_STATS,          // external value adcStatsValues[index]
+    OPC_MODEL_VALUE_HEAPSTATS,          // data source, heapStatsSnapshot.values[index]
+    OPC_MODEL_VALUE_HEAPSTATS_SNAPSHOT, // data source, all of heapStatsSnapshot.pairs
+} OpcModelValue;
+
+/* One node of the information model, generated from firmware.model. NodeIds are kept as
+ * namespace and number so the whole table is constant and stays in flash. */
+typedef struct
+{
+    UA_NodeClass nodeClass;
+    UA_UInt32 id; // in OPC_NS
+    UA_UInt16 parentNs;
+    UA_UInt32 parentId;
+    UA_UInt32 referenceTypeId; // in ns0
+    UA_UInt16 typeDefinitionNs;
+    UA_UInt32 typeDefinitionId; // 0 for none
+    const char *browseName;
+    const char *displayName;
+    const char *description; // NULL for none
+    UA_UInt32 dataTypeId;    // in ns0, variables only
+    UA_Int32 valueRank;
+    OpcModelValue value;
+    UA_UInt32 index;
+    UA_Boolean enabled; // the node's if= condition
+} OpcModelNode;
+
+#include "opc_model_table.h"
+
+/* Nodes created by the first pass of loadOpcModel(), finished by the second */
+static UA_Boolean opcModelBegun[OPC_MODEL_NODE_COUNT];
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Declarations
+ * ----------------------------------------------------------------------------------------------------
+ */
+static size_t loadOpcModel(UA_Server *server);
+
+static UA_StatusCode beginOpcModelNode(UA_Server *server, const OpcModelNode *node);
+
+static UA_StatusCode bindOpcModelValue(UA_Server *server, const OpcModelNode *node);
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Definitions
+ * ----------------------------------------------------------------------------------------------------
+ */
+
+/* Adds the whole model in two passes over opcModelNodes, the way generated nodesets are
+ * loaded: every node is created and bound to its value first, then all of them are
+ * type-checked and constructed. Attributes point into the table, nothing is allocated for
+ * them. A failing node is reported and left out, children of a missing parent fail with it.
+ * Returns the number of nodes that could not be added. */
+static size_t loadOpcModel(UA_Server *server)
+{
+    size_t failed = 0;
+
+    startAdcExternalValues(server);
+    initHeapStatsSnapshot();
+
+    for (size_t i = 0; i < OPC_MODEL_NODE_COUNT; i++)
+    {
+        const OpcModelNode *node = &opcModelNodes[i];
+        UA_StatusCode retval;
+
+        opcModelBegun[i] = false;
+        if (!node->enabled)
+        {
+            continue;
+        }
+
+        retval = beginOpcModelNode(server, node);
+        if (retval == UA_STATUSCODE_GOOD)
+        {
+            retval = bindOpcModelValue(server, node);
+            if (retval != UA_STATUSCODE_GOOD)
+            {
+                UA_Server_deleteNode(server, OPC_NODEID(node->id), true);
+            }
+        }
+
+        if (retval == UA_STATUSCODE_GOOD)
+        {
+            opcModelBegun[i] = true;
+        }
+        else
+        {
+            printf("[OPC UA]\tloadOpcModel(%s) Status: 0x%x (%s)\n", node->browseName, retval, UA_StatusCode_name(retval));
+            failed++;
+        }
+    }
+
+    for (size_t i = 0; i < OPC_MODEL_NODE_COUNT; i++)
+    {
+        const OpcModelNode *node = &opcModelNodes[i];
+
+        if (!opcModelBegun[i])
+        {
+            continue;
+        }
+
+        // A node that fails here is removed again by the server
+        UA_StatusCode retval = UA_Server_addNode_finish(server, OPC_NODEID(node->id));
+        if (retval != UA_STATUSCODE_GOOD)
+        {
+            printf("[OPC UA]\tloadOpcModel(%s) Status: 0x%x (%s)\n", node->browseName, retval, UA_StatusCode_name(retval));
+            failed++;
+        }
+    }
+
+    return failed;
+}
+
+static UA_StatusCode beginOpcModelNode(UA_Server *server, const OpcModelNode *node)
+{
+    UA_NodeId nodeId = OPC_NODEID(node->id);
+    UA_NodeId parentId = UA_NODEID_NUMERIC(node->parentNs, node->parentId);
+    UA_NodeId referenceTypeId = UA_NODEID_NUMERIC(0, node->referenceTypeId);
+    UA_NodeId typeDefinition = UA_NODEID_NULL;
+    UA_QualifiedName browseName = UA_QUALIFIEDNAME(OPC_NS, (char *)node->browseName);
+    UA_LocalizedText displayName = UA_LOCALIZEDTEXT("en-US", (char *)node->displayName);
+    UA_LocalizedText description;
+    void *context = (void *)(uintptr_t)node->index;
+
+    UA_LocalizedText_init(&description);
+    if (node->description != NULL)
+    {
+        description = UA_LOCALIZEDTEXT("en-US", (char *)node->description);
+    }
+
+    if (node->typeDefinitionId != 0)
+    {
+        typeDefinition = UA_NODEID_NUMERIC(node->typeDefinitionNs, node->typeDefinitionId);
+    }
+
+    switch (node->nodeClass)
+    {
+    case UA_NODECLASS_OBJECT:
+    {
+        UA_ObjectAttributes attr = UA_ObjectAttributes_default;
+        attr.displayName = displayName;
+        attr.description = description;
+        return UA_Server_addNode_begin(server, UA_NODECLASS_OBJECT, nodeId, parentId, referenceTypeId,
+                                       browseName, typeDefinition, &attr,
+                                       &UA_TYPES[UA_TYPES_OBJECTATTRIBUTES], context, NULL);
+    }
+    case UA_NODECLASS_OBJECTTYPE:
+    {
+        UA_ObjectTypeAttributes attr = UA_ObjectTypeAttributes_default;
+        attr.displayName = displayName;
+        attr.description = description;
+        return UA_Server_addNode_begin(server, UA_NODECLASS_OBJECTTYPE, nodeId, parentId, referenceTypeId,
+                                       browseName, typeDefinition, &attr,
+                                       &UA_TYPES[UA_TYPES_OBJECTTYPEATTRIBUTES], context, NULL);
+    }
+    case UA_NODECLASS_VARIABLE:
+    {
+        UA_VariableAttributes attr = UA_VariableAttributes_default;
+        attr.displayName = displayName;
+        attr.description = description;
+        attr.dataType = UA_NODEID_NUMERIC(0, node->dataTypeId);
+        attr.valueRank = node->valueRank;
+        attr.accessLevel = UA_ACCESSLEVELMASK_READ;
+        return UA_Server_addNode_begin(server, UA_NODECLASS_VARIABLE, nodeId, parentId, referenceTypeId,
+                                       browseName, typeDefinition, &attr,
+                                       &UA_TYPES[UA_TYPES_VARIABLEATTRIBUTES], context, NULL);
+    }
+    default:
+        return UA_STATUSCODE_BADNODECLASSINVALID;
+    }
+}
+
+/* Attaches the value backend before the node is finished, so the type check reads the real value */
+static UA_StatusCode bindOpcModelValue(UA_Server *server, const OpcModelNode *node)
+{
+    UA_NodeId nodeId = OPC_NODEID(node->id);
+    UA_DataSource dataSource;
+
+    dataSource.write = NULL;
+
+    switch (node->value)
+    {
+    case OPC_MODEL_VALUE_NONE:
+        return UA_STATUSCODE_GOOD;
+    case OPC_MODEL_VALUE_ADC_INPUT:
+        if (node->index >= ADC_ACQ_INPUT_COUNT)
+        {
+            return UA_STATUSCODE_BADINDEXRANGEINVALID;
+        }
+        return OpcExternalValue_attach(server, nodeId, &adcInputValues[node->index]);
+    case OPC_MODEL_VALUE_ADC_STATS:
+        if (node->index >= ADC_STATS_COUNT)
+        {
+            return UA_STATUSCODE_BADINDEXRANGEINVALID;
+        }
+        return OpcExternalValue_attach(server, nodeId, &adcStatsValues[node->index]);
+    case OPC_MODEL_VALUE_HEAPSTATS:
+        if (node->index >= HEAP_STATS_VALUE_COUNT)
+        {
+            return UA_STATUSCODE_BADINDEXRANGEINVALID;
+        }
+        dataSource.read = readHeapStatsValue;
+        return UA_Server_setVariableNode_dataSource(server, nodeId, dataSource);
+    case OPC_MODEL_VALUE_HEAPSTATS_SNAPSHOT:
+        dataSource.read = readHeapStatsSnapshot;
+        return UA_Server_setVariableNode_dataSource(server, nodeId, dataSource);
+    default:
+        return UA_STATUSCODE_BADINTERNALERROR;
+    }
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef OPC_NODE_IDS_H
+#define OPC_NODE_IDS_H
+
+#include "open62541.h"
+
+/* Namespace of the firmware information model */
+#define OPC_NS 1
+
+/* Numeric NodeIds of the firmware information model. Numeric ids hash and compare as one
+ * integer in the nodestore, string ids as a hash and compare over every character. Ranges
+ * leave room for per-instance children, which are addressed as base + index. */
+enum
+{
+    /* Temperature */
+    OPC_ID_SENSOR_TEMP = 1000,
+    OPC_ID_TEMP_DATASOURCE = 1001,
+
+    /* ADC, inputs at OPC_ID_ADC_INPUT + input, statistics at OPC_ID_ADC_STATS + field */
+    OPC_ID_ADC = 2000,
+    OPC_ID_ADC_INPUT = 2010,
+    OPC_ID_ADC_STATS = 2020,
+
+    /* HeapStats, values at OPC_ID_HEAPSTATS_VALUE + snapshot index, slab objects at
+     * OPC_ID_HEAPSTATS_SLAB + slab class */
+    OPC_ID_HEAPSTATS_TYPE = 3000,
+    OPC_ID_HEAPSTATS = 3001,
+    OPC_ID_HEAPSTATS_SNAPSHOT = 3002,
+    OPC_ID_HEAPSTATS_SLAB = 3010,
+    OPC_ID_HEAPSTATS_VALUE = 3100,
+
+    /* TaskStats, a task object at OPC_ID_TASKSTATS_TASK + xTaskNumber * OPC_ID_TASKSTATS_STRIDE
+     * and its values right after it */
+    OPC_ID_TASKSTATS_TYPE = 4000,
+    OPC_ID_TASKSTATS = 4001,
+    OPC_ID_TASKSTATS_TASK = 10000,
+    OPC_ID_TASKSTATS_STRIDE = 8,
+};
+
+#define OPC_NODEID(id) UA_NODEID_NUMERIC(OPC_NS, (UA_UInt32)(id))
+
+#endif
@@ -968,10 +968,11 @@ UA_atomic_subSize(volatile size_t *addr, size_t decrease) {
 #define UA_sleep_ms(X) vTaskDelay(pdMS_TO_TICKS(X))
 
 #ifdef OPEN62541_FEERTOS_USE_OWN_MEM
-# define UA_free vPortFree
-# define UA_malloc pvPortMalloc
-# define UA_calloc pvPortCalloc
-# define UA_realloc pvPortRealloc
+# include <myMalloc.h>
+# define UA_free vSlabFree
+# define UA_malloc pvSlabMalloc
+# define UA_calloc pvSlabCalloc
+# define UA_realloc pvSlabRealloc
 #else
 # define UA_free free
 # define UA_malloc malloc
@@ -26771,12 +26772,34 @@ UA_Server_run_startup(UA_Server *server);
  * @param server The server object.
  * @param waitInternal Should we wait for messages in the networklayer?
  *        Otherwise, the timouts for the networklayers are set to zero.
- *        The default max wait time is 50millisec.
+ *        The default max wait time is 50millisec, 1000millisec with
+ *        UA_ENABLE_SERVER_WAKEUP.
  * @return Returns how long we can wait until the next scheduled
  *         callback (in ms) */
 UA_UInt16 UA_EXPORT
 UA_Server_run_iterate(UA_Server *server, UA_Boolean waitInternal);
 
+#ifdef UA_ENABLE_SERVER_WAKEUP
+/* With UA_ENABLE_SERVER_WAKEUP the task running the server loop sleeps on one
+ * task notification until the next callback is due. The network layer gives
+ * the notification when data arrives. Producers of new data or of a stop
+ * request call UA_Server_wakeup, so the loop iterates right away instead of
+ * after the next timeout. Both can be called before the server is started. */
+#include <FreeRTOS.h>
+#include <task.h>
+
+#ifndef UA_SERVER_NOTIFY_INDEX
+# define UA_SERVER_NOTIFY_INDEX 1
+#endif
+
+/* Can be called from any task */
+void UA_EXPORT
+UA_Server_wakeup(UA_Server *server);
+
+void UA_EXPORT
+UA_Server_wakeupFromISR(UA_Server *server, BaseType_t *higherPriorityTaskWoken);
+#endif
+
 /* The epilogue part of UA_Server_run (no need to use if you call
  * UA_Server_run) */
 UA_StatusCode UA_EXPORT
@@ -31130,6 +31153,24 @@ UA_ServerNetworkLayer UA_EXPORT
 UA_ServerNetworkLayerTCP(UA_ConnectionConfig config, UA_UInt16 port,
                          UA_UInt16 maxConnections);
 
+#ifdef UA_ENABLE_LWIP_NETWORKLAYER
+/* Connection limit of the lwIP network layer added by the server config
+ * helpers, and when maxConnections is 0 */
+#ifndef UA_LWIP_MAXCONNECTIONS
+# define UA_LWIP_MAXCONNECTIONS 4
+#endif
+
+/* Initializes a TCP network layer on top of the lwIP raw API. Received pbufs
+ * are queued per connection from the lwIP callbacks and the server task is
+ * woken by a single task notification per batch, instead of polling every
+ * socket with select. The arguments are the same as for
+ * UA_ServerNetworkLayerTCP, except that maxConnections 0 stands for
+ * UA_LWIP_MAXCONNECTIONS. */
+UA_ServerNetworkLayer UA_EXPORT
+UA_ServerNetworkLayerLWIP(UA_ConnectionConfig config, UA_UInt16 port,
+                          UA_UInt16 maxConnections);
+#endif
+
 /* Open a non-blocking client TCP socket. The connection might not be fully
  * opened yet. Drop into the _poll function withe a timeout to complete the
  * connection. */
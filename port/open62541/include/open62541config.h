@@ -39,6 +39,22 @@
 // #define UA_ENABLE_IMMUTABLE_NODES 
 #define UA_MULTITHREADING 0
 
+/* Network Layer */
+#define UA_ENABLE_LWIP_NETWORKLAYER
+#define UA_RECVBUFFER_POOL_SIZE 2
+#define UA_SENDBUFFER_RING_SIZE 2
+#define UA_LWIP_MAXCONNECTIONS 4
+
+/* Subscriptions */
+#define UA_NOTIFICATION_POOL_MAX 64
+
+/* Timer */
+#define UA_ENABLE_TIMER_WHEEL
+#define UA_TIMER_WHEEL_SLOTS 256
+
+/* Server Loop */
+#define UA_ENABLE_SERVER_WAKEUP
+
 /* Advanced Options */
 #define UA_ENABLE_STATUSCODE_DESCRIPTIONS
 #define UA_ENABLE_TYPEDESCRIPTION
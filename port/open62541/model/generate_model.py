@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""Turns the firmware information model into a table of constant node definitions.
+
+    generate_model.py <model> <output header>
+
+The table is read by loadOpcModel() in opc_model.h. Every field is a constant expression, so
+the table is placed in flash and nothing but the nodes themselves is allocated at boot.
+"""
+
+import os
+import shlex
+import sys
+
+CLASSES = {
+    "object": "UA_NODECLASS_OBJECT",
+    "objecttype": "UA_NODECLASS_OBJECTTYPE",
+    "variable": "UA_NODECLASS_VARIABLE",
+}
+
+DEFAULT_PARENT = {
+    "object": "ns0:OBJECTSFOLDER",
+    "objecttype": "ns0:BASEOBJECTTYPE",
+    "variable": "ns0:OBJECTSFOLDER",
+}
+
+DEFAULT_REF = {
+    "object": "HASCOMPONENT",
+    "objecttype": "HASSUBTYPE",
+    "variable": "HASCOMPONENT",
+}
+
+DEFAULT_TYPEDEF = {
+    "object": "ns0:BASEOBJECTTYPE",
+    "objecttype": None,
+    "variable": "ns0:BASEDATAVARIABLETYPE",
+}
+
+RANKS = {
+    "scalar": "UA_VALUERANK_SCALAR",
+    "array": "UA_VALUERANK_ONE_DIMENSION",
+}
+
+KEYS = {"name", "parent", "ref", "typedef", "display", "description", "type", "rank", "value", "if"}
+
+
+class ModelError(Exception):
+    pass
+
+
+def c_string(text):
+    return '"' + text.replace("\\", "\\\\").replace('"', '\\"') + '"'
+
+
+def node_ref(text):
+    """Returns the (namespace, id) expressions of a parent or type definition."""
+    if text.startswith("ns0:"):
+        return "0", "UA_NS0ID_" + text[4:]
+    return "OPC_NS", text
+
+
+def parse(path):
+    nodes = []
+    ids = set()
+
+    with open(path, encoding="utf-8") as model:
+        for number, line in enumerate(model, 1):
+            words = shlex.split(line, comments=True)
+            if not words:
+                continue
+
+            where = "%s:%d" % (path, number)
+            if len(words) < 2 or words[0] not in CLASSES:
+                raise ModelError("%s: expected '<class> <id> name=...'" % where)
+
+            node = {"class": words[0], "id": words[1], "line": where}
+            for word in words[2:]:
+                key, sep, value = word.partition("=")
+                if not sep or key not in KEYS:
+                    raise ModelError("%s: unknown attribute '%s'" % (where, word))
+                node[key] = value
+
+            cls = node["class"]
+            if "name" not in node:
+                raise ModelError("%s: node without name=" % where)
+            if node["id"] in ids:
+                raise ModelError("%s: duplicate id %s" % (where, node["id"]))
+
+            node.setdefault("parent", DEFAULT_PARENT[cls])
+            node.setdefault("ref", DEFAULT_REF[cls])
+            node.setdefault("typedef", DEFAULT_TYPEDEF[cls])
+            node.setdefault("display", node["name"])
+            node.setdefault("rank", "scalar")
+
+            # Nodes are added in file order, a parent has to exist before its children
+            if not node["parent"].startswith("ns0:") and node["parent"] not in ids:
+                raise ModelError("%s: parent %s is not defined above" % (where, node["parent"]))
+
+            if cls == "variable":
+                if "type" not in node:
+                    raise ModelError("%s: variable without type=" % where)
+                if node["rank"] not in RANKS:
+                    raise ModelError("%s: rank must be one of %s" % (where, ", ".join(RANKS)))
+                if "value" in node and ":" not in node["value"]:
+                    raise ModelError("%s: value must be <source>:<index>" % where)
+            elif "type" in node or "value" in node:
+                raise ModelError("%s: type= and value= are for variables only" % where)
+
+            ids.add(node["id"])
+            nodes.append(node)
+
+    return nodes
+
+
+def emit(nodes, model, out):
+    name = os.path.basename(model)
+
+    out.write("/* Generated by generate_model.py from %s, do not edit */\n" % name)
+    out.write("#ifndef OPC_MODEL_TABLE_H\n")
+    out.write("#define OPC_MODEL_TABLE_H\n\n")
+    out.write("#define OPC_MODEL_NODE_COUNT %d\n\n" % len(nodes))
+    out.write("static const OpcModelNode opcModelNodes[OPC_MODEL_NODE_COUNT] = {\n")
+
+    for node in nodes:
+        parent_ns, parent_id = node_ref(node["parent"])
+        if node["typedef"] is None:
+            typedef_ns, typedef_id = "0", "0"
+        else:
+            typedef_ns, typedef_id = node_ref(node["typedef"])
+
+        if "value" in node:
+            source, index = node["value"].split(":", 1)
+            value = "OPC_MODEL_VALUE_" + source
+        else:
+            value, index = "OPC_MODEL_VALUE_NONE", "0"
+
+        fields = [
+            (".nodeClass", CLASSES[node["class"]]),
+            (".id", "(UA_UInt32)(%s)" % node["id"]),
+            (".parentNs", parent_ns),
+            (".parentId", "(UA_UInt32)(%s)" % parent_id),
+            (".referenceTypeId", "UA_NS0ID_" + node["ref"]),
+            (".typeDefinitionNs", typedef_ns),
+            (".typeDefinitionId", "(UA_UInt32)(%s)" % typedef_id),
+            (".browseName", c_string(node["name"])),
+            (".displayName", c_string(node["display"])),
+            (".description", c_string(node["description"]) if "description" in node else "NULL"),
+            (".dataTypeId", "UA_NS0ID_" + node["type"] if "type" in node else "0"),
+            (".valueRank", RANKS[node["rank"]]),
+            (".value", value),
+            (".index", "(UA_UInt32)(%s)" % index),
+            (".enabled", "((%s) != 0)" % node["if"] if "if" in node else "true"),
+        ]
+
+        out.write("    /* %s */\n" % node["line"].split(os.sep)[-1])
+        out.write("    {%s},\n" % ", ".join("%s = %s" % field for field in fields))
+
+    out.write("};\n\n")
+    out.write("#endif\n")
+
+
+def main(argv):
+    if len(argv) != 3:
+        sys.stderr.write("usage: %s <model> <output header>\n" % argv[0])
+        return 2
+
+    try:
+        nodes = parse(argv[1])
+    except (OSError, ModelError) as error:
+        sys.stderr.write("generate_model.py: %s\n" % error)
+        return 1
+
+    # Written through a temporary file so an interrupted build never leaves half a table
+    temporary = argv[2] + ".tmp"
+    with open(temporary, "w", encoding="utf-8") as out:
+        emit(nodes, argv[1], out)
+    os.replace(temporary, argv[2])
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
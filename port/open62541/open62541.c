@@ -2070,8 +2070,24 @@ _UA_BEGIN_DECLS
 /* Callback where the application is either a client or a server */
 typedef void (*UA_ApplicationCallback)(void *application, void *data);
 
+#ifdef UA_ENABLE_TIMER_WHEEL
+/* Number of 1ms slots in the timer wheel. A power of two. Entries that are due
+ * more than one revolution ahead share a slot with nearer ones and are skipped
+ * until their round comes up. */
+# ifndef UA_TIMER_WHEEL_SLOTS
+#  define UA_TIMER_WHEEL_SLOTS 256
+# endif
+# if (UA_TIMER_WHEEL_SLOTS & (UA_TIMER_WHEEL_SLOTS - 1)) != 0
+#  error UA_TIMER_WHEEL_SLOTS must be a power of two
+# endif
+#endif
+
 typedef struct UA_TimerEntry {
+#ifdef UA_ENABLE_TIMER_WHEEL
+    LIST_ENTRY(UA_TimerEntry) slotEntry;
+#else
     struct aa_entry treeEntry;
+#endif
     UA_TimerPolicy timerPolicy;              /* Timer policy to handle cycle misses */
     UA_DateTime nextTime;                    /* The next time when the callback
                                               * is to be executed */
@@ -2088,7 +2104,15 @@ typedef struct UA_TimerEntry {
 } UA_TimerEntry;
 
 typedef struct {
+#ifdef UA_ENABLE_TIMER_WHEEL
+    /* Hashed timing wheel. An entry sits in the slot of the millisecond tick
+     * of its nextTime (modulo the wheel size). Inserting and expiring is O(1)
+     * and does not depend on the number of entries. */
+    LIST_HEAD(, UA_TimerEntry) slots[UA_TIMER_WHEEL_SLOTS];
+    UA_UInt64 currentTick; /* The tick processed last */
+#else
     struct aa_head root;   /* The root of the time-sorted tree */
+#endif
     struct aa_head idRoot; /* The root of the id-sorted tree */
     UA_UInt64 idCounter;   /* Generate unique identifiers. Identifiers are
                             * always above zero. */
@@ -2377,6 +2401,7 @@ _UA_BEGIN_DECLS
 typedef struct UA_Notification {
     TAILQ_ENTRY(UA_Notification) localEntry;  /* Notification list for the MonitoredItem */
     TAILQ_ENTRY(UA_Notification) globalEntry; /* Notification list for the Subscription */
+    SLIST_ENTRY(UA_Notification) poolEntry;   /* Free list of the notification pool */
     UA_MonitoredItem *mon; /* Always set */
 
     /* The event field is used if mon->attributeId is the EventNotifier */
@@ -2387,14 +2412,21 @@ typedef struct UA_Notification {
 #endif
     } data;
 
+    union {                   /* Inline storage of a scalar boolean or numeric
+                               * DataChange value, which then points here */
+        UA_UInt64 bits;
+        UA_Double alignment;
+    } valueData;
+
 #ifdef UA_ENABLE_SUBSCRIPTIONS_EVENTS
     UA_Boolean isOverflowEvent; /* Counted manually */
     UA_EventFilterResult result;
 #endif
 } UA_Notification;
 
-/* Initializes and sets the sentinel pointers */
-UA_Notification * UA_Notification_new(void);
+/* Initializes and sets the sentinel pointers. Taken from the notification pool
+ * of the server while it has free entries. */
+UA_Notification * UA_Notification_new(UA_Server *server);
 
 /* Notifications are always added to the queue of the MonitoredItem. That queue
  * can overflow. If Notifications are reported, they are also added to the
@@ -2408,8 +2440,11 @@ UA_Notification * UA_Notification_new(void);
 void UA_Notification_enqueueAndTrigger(UA_Server *server,
                                        UA_Notification *n);
 
-/* Dequeue and delete the notification */
-void UA_Notification_delete(UA_Notification *n);
+/* Dequeue and delete the notification, or return it to the pool */
+void UA_Notification_delete(UA_Server *server, UA_Notification *n);
+
+/* Release the notification pool after all notifications are deleted */
+void UA_Notification_clearPool(UA_Server *server);
 
 /* A NotificationMessage contains an array of notifications.
  * Sent NotificationMessages are stored for the republish service. */
@@ -2435,12 +2470,27 @@ typedef TAILQ_HEAD(NotificationMessageQueue, UA_NotificationMessageEntry)
 typedef enum {
     UA_MONITOREDITEMSAMPLINGTYPE_NONE = 0,
     UA_MONITOREDITEMSAMPLINGTYPE_CYCLIC, /* Cyclic callback */
+    UA_MONITOREDITEMSAMPLINGTYPE_GROUP,  /* Cyclic callback of a sampling group */
     UA_MONITOREDITEMSAMPLINGTYPE_EVENT,  /* Attached to the node. Can be a "write
                                           * event" for DataChange MonitoredItems
                                           * with a zero sampling interval .*/
     UA_MONITOREDITEMSAMPLINGTYPE_PUBLISH /* Attached to the subscription */
 } UA_MonitoredItemSamplingType;
 
+/* MonitoredItems of subscriptions that sample the same value attribute with
+ * the same settings share one cyclic callback. The value is read once per
+ * interval and handed to every member, so the sampling cost scales with the
+ * number of distinct nodes and not with the number of subscribers. */
+typedef struct UA_SamplingGroup {
+    LIST_ENTRY(UA_SamplingGroup) listEntry; /* In the server */
+    UA_ReadValueId itemToMonitor;
+    UA_TimestampsToReturn timestampsToReturn;
+    UA_Double samplingInterval;
+    UA_UInt64 callbackId;
+    size_t membersSize;
+    LIST_HEAD(, UA_MonitoredItem) members;
+} UA_SamplingGroup;
+
 struct UA_MonitoredItem {
     UA_TimerEntry delayedFreePointers;
     LIST_ENTRY(UA_MonitoredItem) listEntry; /* Linked list in the Subscription */
@@ -2481,8 +2531,17 @@ struct UA_MonitoredItem {
         UA_MonitoredItem *nodeListNext; /* Event-Based: Attached to Node */
         LIST_ENTRY(UA_MonitoredItem) samplingListEntry; /* Publish-interval: Linked in
                                                          * Subscription */
+        struct {
+            UA_SamplingGroup *group;
+            LIST_ENTRY(UA_MonitoredItem) listEntry; /* Linked in the group */
+        } grouped;
     } sampling;
     UA_DataValue lastValue;
+    union {                   /* Inline storage of a scalar boolean or numeric
+                               * lastValue, which then points here */
+        UA_UInt64 bits;
+        UA_Double alignment;
+    } lastValueData;
 
     /* Triggering Links */
     size_t triggeringLinksSize;
@@ -3853,6 +3912,14 @@ struct UA_Server {
     /* Callbacks with a repetition interval */
     UA_Timer timer;
 
+#ifdef UA_ENABLE_SERVER_WAKEUP
+    /* The task running the server loop, set at startup. It sleeps on the
+     * notification UA_SERVER_NOTIFY_INDEX. Other waits of the task use the
+     * same notification, so a wakeup is also remembered in the flag. */
+    TaskHandle_t task;
+    UA_Boolean wakeupPending;
+#endif
+
     /* For bootstrapping, omit some consistency checks, creating a reference to
      * the parent and member instantiation */
     UA_Boolean bootstrapNS0;
@@ -3875,6 +3942,16 @@ struct UA_Server {
     LIST_HEAD(, UA_MonitoredItem) localMonitoredItems;
     UA_UInt32 lastLocalMonitoredItemId;
 
+    /* Cyclic sampling shared by MonitoredItems with identical settings */
+    LIST_HEAD(, UA_SamplingGroup) samplingGroups;
+
+    /* Preallocated notifications, sized from the subscription limits when the
+     * first notification is created */
+    UA_Boolean notificationPoolReady;
+    UA_Notification *notificationPool;
+    size_t notificationPoolSize;
+    SLIST_HEAD(, UA_Notification) freeNotifications;
+
 # ifdef UA_ENABLE_SUBSCRIPTIONS_ALARMS_CONDITIONS
     LIST_HEAD(, UA_ConditionSource) conditionSources;
 # endif
@@ -17552,6 +17629,7 @@ UA_KeyValueMap_delete(UA_KeyValuePair **map, size_t *mapSize,
  */
 
 
+#ifndef UA_ENABLE_TIMER_WHEEL
 /* There may be several entries with the same nextTime in the tree. We give them
  * an absolute order by considering the memory address to break ties. Because of
  * this, the nextTime property cannot be used to lookup specific entries. */
@@ -17567,6 +17645,7 @@ cmpDateTime(const UA_DateTime *a, const UA_DateTime *b) {
         return AA_CMP_LESS;
     return AA_CMP_MORE;
 }
+#endif
 
 /* The identifiers of entries are unique */
 static enum aa_cmp
@@ -17596,13 +17675,56 @@ calculateNextTime(UA_DateTime currentTime, UA_DateTime baseTime,
     return currentTime + interval - cycleDelay;
 }
 
+#ifdef UA_ENABLE_TIMER_WHEEL
+
+/* The millisecond tick of a point in time. Times before the start of the
+ * monotonic clock fall into tick zero. */
+static UA_UInt64
+timerTick(UA_DateTime time) {
+    if(time <= 0)
+        return 0;
+    return (UA_UInt64)time / UA_DATETIME_MSEC;
+}
+
+/* Entries that are already due go into the slot of the current tick. That slot
+ * is visited first in the next UA_Timer_process. */
+static void
+timerInsert(UA_Timer *t, UA_TimerEntry *te) {
+    UA_UInt64 tick = timerTick(te->nextTime);
+    if(tick < t->currentTick)
+        tick = t->currentTick;
+    LIST_INSERT_HEAD(&t->slots[tick & (UA_TIMER_WHEEL_SLOTS - 1)], te, slotEntry);
+}
+
+static void
+timerRemove(UA_Timer *t, UA_TimerEntry *te) {
+    (void)t;
+    LIST_REMOVE(te, slotEntry);
+}
+
+#else
+
+static void
+timerInsert(UA_Timer *t, UA_TimerEntry *te) {
+    aa_insert(&t->root, te);
+}
+
+static void
+timerRemove(UA_Timer *t, UA_TimerEntry *te) {
+    aa_remove(&t->root, te);
+}
+
+#endif
+
 void
 UA_Timer_init(UA_Timer *t) {
     memset(t, 0, sizeof(UA_Timer));
+#ifndef UA_ENABLE_TIMER_WHEEL
     aa_init(&t->root,
             (enum aa_cmp (*)(const void*, const void*))cmpDateTime,
             offsetof(UA_TimerEntry, treeEntry),
             offsetof(UA_TimerEntry, nextTime));
+#endif
     aa_init(&t->idRoot,
             (enum aa_cmp (*)(const void*, const void*))cmpId,
             offsetof(UA_TimerEntry, idTreeEntry),
@@ -17616,7 +17738,7 @@ UA_Timer_addTimerEntry(UA_Timer *t, UA_TimerEntry *te, UA_UInt64 *callbackId) {
     te->id = ++t->idCounter;
     if(callbackId)
         *callbackId = te->id;
-    aa_insert(&t->root, te);
+    timerInsert(t, te);
     aa_insert(&t->idRoot, te);
     UA_UNLOCK(&t->timerMutex);
 }
@@ -17647,7 +17769,7 @@ addCallback(UA_Timer *t, UA_ApplicationCallback callback, void *application,
     if(callbackId)
         *callbackId = te->id;
 
-    aa_insert(&t->root, te);
+    timerInsert(t, te);
     aa_insert(&t->idRoot, te);
     return UA_STATUSCODE_GOOD;
 }
@@ -17715,7 +17837,7 @@ UA_Timer_changeRepeatedCallback(UA_Timer *t, UA_UInt64 callbackId,
         UA_UNLOCK(&t->timerMutex);
         return UA_STATUSCODE_BADNOTFOUND;
     }
-    aa_remove(&t->root, te);
+    timerRemove(t, te);
 
     /* Compute the next time for execution. The logic is identical to the
      * creation of a new repeated callback. */
@@ -17730,7 +17852,7 @@ UA_Timer_changeRepeatedCallback(UA_Timer *t, UA_UInt64 callbackId,
     /* Update the remaining parameters and re-insert */
     te->interval = interval;
     te->timerPolicy = timerPolicy;
-    aa_insert(&t->root, te);
+    timerInsert(t, te);
 
     UA_UNLOCK(&t->timerMutex);
     return UA_STATUSCODE_GOOD;
@@ -17741,13 +17863,138 @@ UA_Timer_removeCallback(UA_Timer *t, UA_UInt64 callbackId) {
     UA_LOCK(&t->timerMutex);
     UA_TimerEntry *te = (UA_TimerEntry*)aa_find(&t->idRoot, &callbackId);
     if(UA_LIKELY(te != NULL)) {
-        aa_remove(&t->root, te);
+        timerRemove(t, te);
         aa_remove(&t->idRoot, te);
         UA_free(te);
     }
     UA_UNLOCK(&t->timerMutex);
 }
 
+/* Set the time for the next execution. Prevent an infinite loop by forcing the
+ * execution time in the next iteration.
+ *
+ * If the timer policy is "CurrentTime", then there is at least the interval
+ * between executions. This is used for Monitoreditems, for which the spec says:
+ * The sampling interval indicates the fastest rate at which the Server should
+ * sample its underlying source for data changes. (Part 4, 5.12.1.2) */
+static void
+rescheduleEntry(UA_TimerEntry *te, UA_DateTime nowMonotonic) {
+    te->nextTime += (UA_DateTime)te->interval;
+    if(te->nextTime < nowMonotonic) {
+        if(te->timerPolicy == UA_TIMER_HANDLE_CYCLEMISS_WITH_BASETIME)
+            te->nextTime = calculateNextTime(nowMonotonic, te->nextTime,
+                                             (UA_DateTime)te->interval);
+        else
+            te->nextTime = nowMonotonic + (UA_DateTime)te->interval;
+    }
+}
+
+#ifdef UA_ENABLE_TIMER_WHEEL
+
+/* Dispatch the due entries of one slot. The slot is emptied into a local list
+ * first. Entries of a later round and rescheduled entries go back into the
+ * wheel, so they are not seen twice. The callbacks may remove entries that are
+ * still in the local list, so it is only ever read from the head. */
+static void
+processSlot(UA_Timer *t, size_t slot, UA_DateTime nowMonotonic,
+            UA_TimerExecutionCallback executionCallback,
+            void *executionApplication) {
+    LIST_HEAD(, UA_TimerEntry) pending = LIST_HEAD_INITIALIZER(pending);
+    UA_TimerEntry *te;
+    while((te = LIST_FIRST(&t->slots[slot]))) {
+        LIST_REMOVE(te, slotEntry);
+        LIST_INSERT_HEAD(&pending, te, slotEntry);
+    }
+
+    while((te = LIST_FIRST(&pending))) {
+        LIST_REMOVE(te, slotEntry);
+
+        if(te->nextTime > nowMonotonic) {
+            timerInsert(t, te);
+            continue;
+        }
+
+        if(te->interval == 0) {
+            aa_remove(&t->idRoot, te);
+            if(te->callback) {
+                UA_UNLOCK(&t->timerMutex);
+                executionCallback(executionApplication, te->callback,
+                                  te->application, te->data);
+                UA_LOCK(&t->timerMutex);
+            }
+            UA_free(te);
+            continue;
+        }
+
+        rescheduleEntry(te, nowMonotonic);
+        timerInsert(t, te);
+
+        if(!te->callback)
+            continue;
+
+        UA_ApplicationCallback cb = te->callback;
+        void *app = te->application;
+        void *data = te->data;
+        UA_UNLOCK(&t->timerMutex);
+        executionCallback(executionApplication, cb, app, data);
+        UA_LOCK(&t->timerMutex);
+    }
+}
+
+/* The earliest nextTime within one revolution from the current tick. A slot
+ * also holds the entries of later rounds, those are skipped. If nothing is due
+ * within the revolution, the wheel has to be looked at again when it is
+ * over. */
+static UA_DateTime
+nextWheelTime(UA_Timer *t) {
+    if(!t->idRoot.root)
+        return UA_INT64_MAX;
+    UA_UInt64 tick = t->currentTick;
+    for(size_t i = 0; i < UA_TIMER_WHEEL_SLOTS; i++, tick++) {
+        UA_DateTime next = UA_INT64_MAX;
+        UA_TimerEntry *te;
+        LIST_FOREACH(te, &t->slots[tick & (UA_TIMER_WHEEL_SLOTS - 1)], slotEntry) {
+            if(timerTick(te->nextTime) <= tick && te->nextTime < next)
+                next = te->nextTime;
+        }
+        if(next != UA_INT64_MAX)
+            return next;
+    }
+    return (UA_DateTime)(tick * UA_DATETIME_MSEC);
+}
+
+UA_DateTime
+UA_Timer_process(UA_Timer *t, UA_DateTime nowMonotonic,
+                 UA_TimerExecutionCallback executionCallback,
+                 void *executionApplication) {
+    UA_LOCK(&t->timerMutex);
+
+    /* Visit every slot from the last processed tick up to now. If the timer
+     * was not processed for a whole revolution, every slot is visited once. */
+    UA_UInt64 nowTick = timerTick(nowMonotonic);
+    if(nowTick >= t->currentTick + UA_TIMER_WHEEL_SLOTS)
+        t->currentTick = nowTick - UA_TIMER_WHEEL_SLOTS + 1;
+
+    /* The current tick stays on the slot of now. Entries due later within the
+     * same millisecond remain there for the next call. */
+    while(true) {
+        processSlot(t, (size_t)(t->currentTick & (UA_TIMER_WHEEL_SLOTS - 1)),
+                    nowMonotonic, executionCallback, executionApplication);
+        if(t->currentTick >= nowTick)
+            break;
+        t->currentTick++;
+    }
+
+    /* Return the timestamp of the earliest next callback */
+    UA_DateTime next = nextWheelTime(t);
+    if(next < nowMonotonic)
+        next = nowMonotonic;
+    UA_UNLOCK(&t->timerMutex);
+    return next;
+}
+
+#else
+
 UA_DateTime
 UA_Timer_process(UA_Timer *t, UA_DateTime nowMonotonic,
                  UA_TimerExecutionCallback executionCallback,
@@ -17774,23 +18021,7 @@ UA_Timer_process(UA_Timer *t, UA_DateTime nowMonotonic,
             continue;
         }
 
-        /* Set the time for the next execution. Prevent an infinite loop by
-         * forcing the execution time in the next iteration.
-         *
-         * If the timer policy is "CurrentTime", then there is at least the
-         * interval between executions. This is used for Monitoreditems, for
-         * which the spec says: The sampling interval indicates the fastest rate
-         * at which the Server should sample its underlying source for data
-         * changes. (Part 4, 5.12.1.2) */
-        first->nextTime += (UA_DateTime)first->interval;
-        if(first->nextTime < nowMonotonic) {
-            if(first->timerPolicy == UA_TIMER_HANDLE_CYCLEMISS_WITH_BASETIME)
-                first->nextTime = calculateNextTime(nowMonotonic, first->nextTime,
-                                                    (UA_DateTime)first->interval);
-            else
-                first->nextTime = nowMonotonic + (UA_DateTime)first->interval;
-        }
-
+        rescheduleEntry(first, nowMonotonic);
         aa_insert(&t->root, first);
 
         if(!first->callback)
@@ -17816,6 +18047,8 @@ UA_Timer_process(UA_Timer *t, UA_DateTime nowMonotonic,
     return next;
 }
 
+#endif
+
 void
 UA_Timer_clear(UA_Timer *t) {
     UA_LOCK(&t->timerMutex);
@@ -17828,7 +18061,12 @@ UA_Timer_clear(UA_Timer *t) {
     }
 
     /* Reset the trees to avoid future access */
+#ifdef UA_ENABLE_TIMER_WHEEL
+    for(size_t i = 0; i < UA_TIMER_WHEEL_SLOTS; i++)
+        LIST_INIT(&t->slots[i]);
+#else
     t->root.root = NULL;
+#endif
     t->idRoot.root = NULL;
 
     UA_UNLOCK(&t->timerMutex);
@@ -21046,6 +21284,9 @@ void UA_Server_delete(UA_Server *server) {
     UA_assert(server->monitoredItemsSize == 0);
     UA_assert(server->subscriptionsSize == 0);
 
+    /* All notifications were deleted with their MonitoredItems */
+    UA_Notification_clearPool(server);
+
 #ifdef UA_ENABLE_SUBSCRIPTIONS_ALARMS_CONDITIONS
     UA_ConditionList_delete(server);
 #endif
@@ -21410,7 +21651,17 @@ UA_Server_getStatistics(UA_Server *server) {
 /* Main Server Loop */
 /********************/
 
-#define UA_MAXTIMEOUT 50 /* Max timeout in ms between main-loop iterations */
+#if defined(UA_ENABLE_SERVER_WAKEUP) && !defined(UA_ENABLE_LWIP_NETWORKLAYER)
+# error "UA_ENABLE_SERVER_WAKEUP requires the lwIP network layer"
+#endif
+
+#ifdef UA_ENABLE_SERVER_WAKEUP
+/* The network layer and UA_Server_wakeup end the sleep early. The timeout only
+ * bounds how late the shutdown conditions are seen. */
+# define UA_MAXTIMEOUT 1000
+#else
+# define UA_MAXTIMEOUT 50 /* Max timeout in ms between main-loop iterations */
+#endif
 
 /* Start: Spin up the workers and the network layer and sample the server's
  *        start time.
@@ -21465,6 +21716,10 @@ UA_Server_run_startup(UA_Server *server) {
                          UA_NODEID_NUMERIC(0, UA_NS0ID_SERVER_SERVERSTATUS_STARTTIME),
                          var);
 
+#ifdef UA_ENABLE_SERVER_WAKEUP
+    server->task = xTaskGetCurrentTaskHandle();
+#endif
+
     /* Start the networklayers */
     UA_StatusCode result = UA_STATUSCODE_GOOD;
     for(size_t i = 0; i < server->config.networkLayersSize; ++i) {
@@ -21536,6 +21791,16 @@ UA_Server_run_iterate(UA_Server *server, UA_Boolean waitInternal) {
 
     UA_UInt16 timeout = 0;
 
+#ifdef UA_ENABLE_SERVER_WAKEUP
+    /* Do not sleep over a wakeup whose notification was already taken. There
+     * is no byte exchange on Cortex-M0+, so load and clear separately. A
+     * wakeup in between still leaves its notification to end the wait. */
+    if(__atomic_load_n(&server->wakeupPending, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&server->wakeupPending, false, __ATOMIC_RELAXED);
+        waitInternal = false;
+    }
+#endif
+
     /* round always to upper value to avoid timeout to be set to 0
     * if(nextRepeated - now) < (UA_DATETIME_MSEC/2) */
     if(waitInternal)
@@ -21583,6 +21848,25 @@ UA_Server_run_iterate(UA_Server *server, UA_Boolean waitInternal) {
     return timeout;
 }
 
+#ifdef UA_ENABLE_SERVER_WAKEUP
+
+void
+UA_Server_wakeup(UA_Server *server) {
+    __atomic_store_n(&server->wakeupPending, true, __ATOMIC_RELEASE);
+    if(server->task)
+        xTaskNotifyGiveIndexed(server->task, UA_SERVER_NOTIFY_INDEX);
+}
+
+void
+UA_Server_wakeupFromISR(UA_Server *server, BaseType_t *higherPriorityTaskWoken) {
+    __atomic_store_n(&server->wakeupPending, true, __ATOMIC_RELEASE);
+    if(server->task)
+        vTaskNotifyGiveIndexedFromISR(server->task, UA_SERVER_NOTIFY_INDEX,
+                                      higherPriorityTaskWoken);
+}
+
+#endif
+
 UA_StatusCode
 UA_Server_run_shutdown(UA_Server *server) {
     /* Stop the netowrk layer */
@@ -37131,24 +37415,28 @@ readValueAttributeComplete(UA_Server *server, UA_Session *session,
             //TODO change old structure to value backend
             break;
         case UA_VALUEBACKENDTYPE_EXTERNAL:
+            /* The read notification is optional. Without it the external
+             * value is read as it is. */
             if(vn->valueBackend.backend.external.callback.notificationRead){
                 retval = vn->valueBackend.backend.external.callback.
                     notificationRead(server,
                                      session ? &session->sessionId : NULL,
                                      session ? session->sessionHandle : NULL,
                                      &vn->head.nodeId, vn->head.context, rangeptr);
-            } else {
-                retval = UA_STATUSCODE_BADNOTREADABLE;
             }
             if(retval != UA_STATUSCODE_GOOD){
                 break;
             }
-            /* Set the result */
-            if(rangeptr)
+            /* Set the result. The external value is owned by the application
+             * and outlives the read, so the result points into it with
+             * UA_VARIANT_DATA_NODELETE instead of copying. */
+            if(rangeptr) {
                 retval = UA_DataValue_copyVariantRange(
                     *vn->valueBackend.backend.external.value, v, *rangeptr);
-            else
-                retval = UA_DataValue_copy(*vn->valueBackend.backend.external.value, v);
+            } else {
+                *v = **vn->valueBackend.backend.external.value;
+                v->value.storageType = UA_VARIANT_DATA_NODELETE;
+            }
             break;
         case UA_VALUEBACKENDTYPE_NONE:
             /* Read the value */
@@ -37570,7 +37858,23 @@ UA_DataValue
 readAttribute(UA_Server *server, const UA_ReadValueId *item,
                UA_TimestampsToReturn timestamps) {
     UA_LOCK_ASSERT(&server->serviceMutex, 1);
-    return UA_Server_readWithSession(server, &server->adminSession, item, timestamps);
+    UA_DataValue dv =
+        UA_Server_readWithSession(server, &server->adminSession, item, timestamps);
+
+    /* Local readers own the result. Copy values that point into the node or
+     * into an external value backend. */
+    if(dv.hasValue && dv.value.storageType == UA_VARIANT_DATA_NODELETE) {
+        UA_DataValue copy;
+        UA_StatusCode res = UA_DataValue_copy(&dv, &copy);
+        if(res != UA_STATUSCODE_GOOD) {
+            UA_DataValue_init(&dv);
+            dv.hasStatus = true;
+            dv.status = res;
+            return dv;
+        }
+        dv = copy;
+    }
+    return dv;
 }
 
 UA_StatusCode
@@ -52857,6 +53161,7 @@ prepareNotificationMessage(UA_Server *server, UA_Subscription *sub,
     /* Pre-allocate DataChangeNotifications */
     size_t notificationDataIdx = 0;
     size_t dcnPos = 0; /* How many DataChangeNotifications? */
+    size_t dcnSize = 0; /* Allocated DataChangeNotifications */
     UA_DataChangeNotification *dcn = NULL;
     if(sub->dataChangeNotifications > 0) {
         dcn = UA_DataChangeNotification_new();
@@ -52866,11 +53171,13 @@ prepareNotificationMessage(UA_Server *server, UA_Subscription *sub,
         }
         UA_ExtensionObject_setValue(message->notificationData, dcn,
                                     &UA_TYPES[UA_TYPES_DATACHANGENOTIFICATION]);
-        size_t dcnSize = sub->dataChangeNotifications;
+        dcnSize = sub->dataChangeNotifications;
         if(dcnSize > maxNotifications)
             dcnSize = maxNotifications;
+        /* Scalar values stored inline in the notifications move to a slot
+         * behind the array. They are released together with the array. */
         dcn->monitoredItems = (UA_MonitoredItemNotification*)
-            UA_Array_new(dcnSize, &UA_TYPES[UA_TYPES_MONITOREDITEMNOTIFICATION]);
+            UA_calloc(dcnSize, sizeof(UA_MonitoredItemNotification) + sizeof(UA_UInt64));
         if(!dcn->monitoredItems) {
             UA_NotificationMessage_clear(message);
             return UA_STATUSCODE_BADOUTOFMEMORY;
@@ -52927,13 +53234,20 @@ prepareNotificationMessage(UA_Server *server, UA_Subscription *sub,
             enlPos++;
             break;
 #endif
-        default:
+        default: {
             UA_assert(dcn != NULL); /* Have at least one change notification */
-            dcn->monitoredItems[dcnPos] = notification->data.dataChange;
+            UA_MonitoredItemNotification *min = &dcn->monitoredItems[dcnPos];
+            *min = notification->data.dataChange;
+            if(min->value.value.data == &notification->valueData) {
+                UA_UInt64 *slot = (UA_UInt64*)&dcn->monitoredItems[dcnSize] + dcnPos;
+                *slot = notification->valueData.bits;
+                min->value.value.data = slot;
+            }
             UA_DataValue_init(&notification->data.dataChange.value);
             dcnPos++;
             break;
         }
+        }
 
         /* If there are Notifications *before this one* in the MonitoredItem-
          * local queue, remove all of them. These are earlier Notifications that
@@ -52941,11 +53255,11 @@ prepareNotificationMessage(UA_Server *server, UA_Subscription *sub,
          * current Notification has been sent out. */
         UA_Notification *prev;
         while((prev = TAILQ_PREV(notification, NotificationQueue, localEntry))) {
-            UA_Notification_delete(prev);
+            UA_Notification_delete(server, prev);
         }
 
         /* Delete the notification, remove from the queues and decrease the counters */
-        UA_Notification_delete(notification);
+        UA_Notification_delete(server, notification);
 
         totalNotifications++;
     }
@@ -53396,7 +53710,7 @@ createEventOverflowNotification(UA_Server *server, UA_Subscription *sub,
      * NodeId of the OverflowEventType. */
 
     /* Allocate the notification */
-    UA_Notification *overflowNotification = UA_Notification_new();
+    UA_Notification *overflowNotification = UA_Notification_new(server);
     if(!overflowNotification)
         return UA_STATUSCODE_BADOUTOFMEMORY;
 
@@ -53414,7 +53728,7 @@ createEventOverflowNotification(UA_Server *server, UA_Subscription *sub,
         UA_Variant_setScalarCopy(overflowNotification->data.event.eventFields,
                                  &eventQueueOverflowEventType, &UA_TYPES[UA_TYPES_NODEID]);
     if(retval != UA_STATUSCODE_GOOD) {
-        UA_Notification_delete(overflowNotification);
+        UA_Notification_delete(server, overflowNotification);
         return retval;
     }
 
@@ -53512,9 +53826,63 @@ UA_MonitoredItem_removeOverflowInfoBits(UA_MonitoredItem *mon) {
         (UA_STATUSCODE_INFOTYPE_DATAVALUE | UA_STATUSCODE_INFOBITS_OVERFLOW);
 }
 
+/* Upper bound for the notification pool, whatever the limits allow */
+#ifndef UA_NOTIFICATION_POOL_MAX
+# define UA_NOTIFICATION_POOL_MAX 64
+#endif
+
+/* Enough notifications for every MonitoredItem to fill its queue, or else for
+ * one full publish response. Further notifications come from the heap. */
+static void
+UA_Notification_initPool(UA_Server *server) {
+    const UA_ServerConfig *config = &server->config;
+    server->notificationPoolReady = true;
+    SLIST_INIT(&server->freeNotifications);
+
+    size_t size = config->maxNotificationsPerPublish;
+    if(config->maxMonitoredItems > 0) {
+        size_t queued = (size_t)config->maxMonitoredItems * config->queueSizeLimits.max;
+        if(size == 0 || queued < size)
+            size = queued;
+    }
+    if(size == 0 || size > UA_NOTIFICATION_POOL_MAX)
+        size = UA_NOTIFICATION_POOL_MAX;
+
+    server->notificationPool = (UA_Notification*)
+        UA_calloc(size, sizeof(UA_Notification));
+    if(!server->notificationPool) {
+        UA_LOG_WARNING(&server->config.logger, UA_LOGCATEGORY_SERVER,
+                       "Could not allocate the notification pool, "
+                       "notifications are allocated one by one");
+        return;
+    }
+    server->notificationPoolSize = size;
+    for(size_t i = 0; i < size; i++)
+        SLIST_INSERT_HEAD(&server->freeNotifications,
+                          &server->notificationPool[i], poolEntry);
+}
+
+void
+UA_Notification_clearPool(UA_Server *server) {
+    UA_free(server->notificationPool);
+    server->notificationPool = NULL;
+    server->notificationPoolSize = 0;
+    server->notificationPoolReady = false;
+    SLIST_INIT(&server->freeNotifications);
+}
+
 UA_Notification *
-UA_Notification_new(void) {
-    UA_Notification *n = (UA_Notification*)UA_calloc(1, sizeof(UA_Notification));
+UA_Notification_new(UA_Server *server) {
+    if(!server->notificationPoolReady)
+        UA_Notification_initPool(server);
+
+    UA_Notification *n = SLIST_FIRST(&server->freeNotifications);
+    if(n) {
+        SLIST_REMOVE_HEAD(&server->freeNotifications, poolEntry);
+        memset(n, 0, sizeof(UA_Notification));
+    } else {
+        n = (UA_Notification*)UA_calloc(1, sizeof(UA_Notification));
+    }
     if(n) {
         /* Set the sentinel for a notification that is not enqueued */
         TAILQ_NEXT(n, globalEntry) = UA_SUBSCRIPTION_QUEUE_SENTINEL;
@@ -53528,7 +53896,7 @@ static void UA_Notification_enqueueSub(UA_Notification *n);
 static void UA_Notification_dequeueSub(UA_Notification *n);
 
 void
-UA_Notification_delete(UA_Notification *n) {
+UA_Notification_delete(UA_Server *server, UA_Notification *n) {
     UA_assert(n != UA_SUBSCRIPTION_QUEUE_SENTINEL);
     if(n->mon) {
         UA_Notification_dequeueMon(n);
@@ -53545,6 +53913,13 @@ UA_Notification_delete(UA_Notification *n) {
             break;
         }
     }
+
+    /* Return to the pool */
+    if(n >= server->notificationPool &&
+       n < server->notificationPool + server->notificationPoolSize) {
+        SLIST_INSERT_HEAD(&server->freeNotifications, n, poolEntry);
+        return;
+    }
     UA_free(n);
 }
 
@@ -53860,7 +54235,7 @@ UA_MonitoredItem_setMonitoringMode(UA_Server *server, UA_MonitoredItem *mon,
         UA_Notification *notification_tmp;
         UA_MonitoredItem_unregisterSampling(server, mon);
         TAILQ_FOREACH_SAFE(notification, &mon->queue, localEntry, notification_tmp) {
-            UA_Notification_delete(notification);
+            UA_Notification_delete(server, notification);
         }
         UA_DataValue_clear(&mon->lastValue);
         return UA_STATUSCODE_GOOD;
@@ -53925,7 +54300,7 @@ UA_MonitoredItem_delete(UA_Server *server, UA_MonitoredItem *mon) {
     /* Remove the queued notifications attached to the subscription */
     UA_Notification *notification, *notification_tmp;
     TAILQ_FOREACH_SAFE(notification, &mon->queue, localEntry, notification_tmp) {
-        UA_Notification_delete(notification);
+        UA_Notification_delete(server, notification);
     }
 
     /* Remove the settings */
@@ -54018,7 +54393,7 @@ UA_MonitoredItem_ensureQueueSpace(UA_Server *server, UA_MonitoredItem *mon) {
         remove--;
 
         /* Delete the notification and remove it from the queues */
-        UA_Notification_delete(del);
+        UA_Notification_delete(server, del);
 
         /* Update the subscription diagnostics statistics */
 #ifdef UA_ENABLE_DIAGNOSTICS
@@ -54043,6 +54418,120 @@ UA_MonitoredItem_ensureQueueSpace(UA_Server *server, UA_MonitoredItem *mon) {
     }
 }
 
+/* The value is read once with the admin session. Every member gets it only
+ * if the user of its own session may read the node. */
+static void
+samplingGroup_sampleCallback(UA_Server *server, UA_SamplingGroup *group) {
+    UA_LOCK(&server->serviceMutex);
+
+    UA_LOG_DEBUG(&server->config.logger, UA_LOGCATEGORY_SERVER,
+                 "Sampling group | Sample callback called for %lu MonitoredItems",
+                 (long unsigned)group->membersSize);
+
+    /* Sample the value once for the whole group */
+    UA_DataValue value = UA_Server_readWithSession(server, &server->adminSession,
+                                                   &group->itemToMonitor,
+                                                   group->timestampsToReturn);
+
+    /* Keep the node for the per-member access check */
+    const UA_Node *node = UA_NODESTORE_GET(server, &group->itemToMonitor.nodeId);
+
+    UA_MonitoredItem *mon, *mon_tmp;
+    LIST_FOREACH_SAFE(mon, &group->members, sampling.grouped.listEntry, mon_tmp) {
+        UA_Subscription *sub = mon->subscription;
+
+        /* Every member gets a shallow copy. The members copy what they keep,
+         * the sample itself is cleared after the last member. */
+        UA_DataValue sample = value;
+        if(sample.hasValue)
+            sample.value.storageType = UA_VARIANT_DATA_NODELETE;
+
+        if(node && node->head.nodeClass == UA_NODECLASS_VARIABLE &&
+           !(getUserAccessLevel(server, sub->session, &node->variableNode) &
+             UA_ACCESSLEVELMASK_READ)) {
+            UA_DataValue_init(&sample);
+            sample.hasStatus = true;
+            sample.status = UA_STATUSCODE_BADUSERACCESSDENIED;
+        }
+
+        UA_StatusCode res = sampleCallbackWithValue(server, sub, mon, &sample);
+        if(res != UA_STATUSCODE_GOOD) {
+            UA_LOG_WARNING_SUBSCRIPTION(&server->config.logger, sub,
+                                        "MonitoredItem %" PRIi32 " | "
+                                        "Sampling returned the statuscode %s",
+                                        mon->monitoredItemId,
+                                        UA_StatusCode_name(res));
+        }
+    }
+
+    if(node)
+        UA_NODESTORE_RELEASE(server, node);
+    UA_DataValue_clear(&value);
+    UA_UNLOCK(&server->serviceMutex);
+}
+
+static UA_Boolean
+samplingGroup_matches(const UA_SamplingGroup *group, const UA_MonitoredItem *mon) {
+    const UA_ReadValueId *a = &group->itemToMonitor;
+    const UA_ReadValueId *b = &mon->itemToMonitor;
+    return group->samplingInterval == mon->parameters.samplingInterval &&
+        group->timestampsToReturn == mon->timestampsToReturn &&
+        a->attributeId == b->attributeId &&
+        UA_NodeId_equal(&a->nodeId, &b->nodeId) &&
+        UA_String_equal(&a->indexRange, &b->indexRange) &&
+        UA_QualifiedName_equal(&a->dataEncoding, &b->dataEncoding);
+}
+
+static UA_StatusCode
+addToSamplingGroup(UA_Server *server, UA_MonitoredItem *mon) {
+    UA_SamplingGroup *group;
+    LIST_FOREACH(group, &server->samplingGroups, listEntry) {
+        if(samplingGroup_matches(group, mon))
+            break;
+    }
+
+    /* Create a new group with its own callback */
+    if(!group) {
+        group = (UA_SamplingGroup*)UA_calloc(1, sizeof(UA_SamplingGroup));
+        if(!group)
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+        UA_StatusCode res = UA_ReadValueId_copy(&mon->itemToMonitor, &group->itemToMonitor);
+        if(res == UA_STATUSCODE_GOOD)
+            res = addRepeatedCallback(server,
+                                      (UA_ServerCallback)samplingGroup_sampleCallback,
+                                      group, mon->parameters.samplingInterval,
+                                      &group->callbackId);
+        if(res != UA_STATUSCODE_GOOD) {
+            UA_ReadValueId_clear(&group->itemToMonitor);
+            UA_free(group);
+            return res;
+        }
+        group->timestampsToReturn = mon->timestampsToReturn;
+        group->samplingInterval = mon->parameters.samplingInterval;
+        LIST_INSERT_HEAD(&server->samplingGroups, group, listEntry);
+    }
+
+    LIST_INSERT_HEAD(&group->members, mon, sampling.grouped.listEntry);
+    group->membersSize++;
+    mon->sampling.grouped.group = group;
+    return UA_STATUSCODE_GOOD;
+}
+
+static void
+removeFromSamplingGroup(UA_Server *server, UA_MonitoredItem *mon) {
+    UA_SamplingGroup *group = mon->sampling.grouped.group;
+    LIST_REMOVE(mon, sampling.grouped.listEntry);
+    mon->sampling.grouped.group = NULL;
+    group->membersSize--;
+    if(group->membersSize > 0)
+        return;
+
+    removeCallback(server, group->callbackId);
+    LIST_REMOVE(group, listEntry);
+    UA_ReadValueId_clear(&group->itemToMonitor);
+    UA_free(group);
+}
+
 UA_StatusCode
 UA_MonitoredItem_registerSampling(UA_Server *server, UA_MonitoredItem *mon) {
     UA_LOCK_ASSERT(&server->serviceMutex, 1);
@@ -54070,6 +54559,12 @@ UA_MonitoredItem_registerSampling(UA_Server *server, UA_MonitoredItem *mon) {
             return UA_STATUSCODE_BADINTERNALERROR; /* Not possible for local MonitoredItems */
         LIST_INSERT_HEAD(&sub->samplingMonitoredItems, mon, sampling.samplingListEntry);
         mon->samplingType = UA_MONITOREDITEMSAMPLINGTYPE_PUBLISH;
+    } else if(sub && mon->itemToMonitor.attributeId == UA_ATTRIBUTEID_VALUE) {
+        /* Value MonitoredItems of subscriptions share the cyclic callback with
+         * the other MonitoredItems sampling the same value */
+        res = addToSamplingGroup(server, mon);
+        if(res == UA_STATUSCODE_GOOD)
+            mon->samplingType = UA_MONITOREDITEMSAMPLINGTYPE_GROUP;
     } else {
         /* DataChange MonitoredItems with a positive sampling interval have a
          * repeated callback. Other MonitoredItems are attached to the Node in a
@@ -54095,6 +54590,11 @@ UA_MonitoredItem_unregisterSampling(UA_Server *server, UA_MonitoredItem *mon) {
         removeCallback(server, mon->sampling.callbackId);
         break;
 
+    case UA_MONITOREDITEMSAMPLINGTYPE_GROUP:
+        /* Leave the sampling group, the last member removes it */
+        removeFromSamplingGroup(server, mon);
+        break;
+
     case UA_MONITOREDITEMSAMPLINGTYPE_EVENT: {
         /* Added to a node */
         UA_Subscription *sub = mon->subscription;
@@ -54260,6 +54760,14 @@ detectVariantDeadband(const UA_Variant *value, const UA_Variant *oldValue,
     return false;
 }
 
+/* Scalars of the builtin boolean and numeric types fit into the inline
+ * lastValue storage of the MonitoredItem and are compared bit by bit */
+static UA_Boolean
+isInlineScalar(const UA_Variant *v) {
+    return v->type != NULL && v->type->typeKind <= UA_DATATYPEKIND_DOUBLE &&
+        v->type->memSize <= sizeof(UA_UInt64) && UA_Variant_isScalar(v);
+}
+
 static UA_Boolean
 detectValueChange(UA_Server *server, UA_MonitoredItem *mon,
                   const UA_DataValue *value) {
@@ -54307,6 +54815,10 @@ detectValueChange(UA_Server *server, UA_MonitoredItem *mon,
     /* Has the value changed? */
     if(value->hasValue != mon->lastValue.hasValue)
         return true;
+    if(isInlineScalar(&value->value) && isInlineScalar(&mon->lastValue.value))
+        return (value->value.type != mon->lastValue.value.type ||
+                memcmp(value->value.data, mon->lastValue.value.data,
+                       value->value.type->memSize) != 0);
     return (UA_order(&value->value, &mon->lastValue.value,
                      &UA_TYPES[UA_TYPES_VARIANT]) != UA_ORDER_EQ);
 }
@@ -54316,18 +54828,28 @@ UA_MonitoredItem_createDataChangeNotification(UA_Server *server, UA_Subscription
                                               UA_MonitoredItem *mon,
                                               const UA_DataValue *value) {
     /* Allocate a new notification */
-    UA_Notification *newNotification = UA_Notification_new();
+    UA_Notification *newNotification = UA_Notification_new(server);
     if(!newNotification)
         return UA_STATUSCODE_BADOUTOFMEMORY;
 
-    /* Prepare the notification */
-    newNotification->mon = mon;
+    /* Prepare the notification. Scalar booleans and numerics are stored in
+     * the notification itself, without an allocation. */
     newNotification->data.dataChange.clientHandle = mon->parameters.clientHandle;
-    UA_StatusCode retval = UA_DataValue_copy(value, &newNotification->data.dataChange.value);
-    if(retval != UA_STATUSCODE_GOOD) {
-        UA_free(newNotification);
-        return retval;
+    UA_DataValue *dst = &newNotification->data.dataChange.value;
+    if(value->hasValue && isInlineScalar(&value->value)) {
+        *dst = *value;
+        memcpy(&newNotification->valueData, value->value.data,
+               value->value.type->memSize);
+        dst->value.data = &newNotification->valueData;
+        dst->value.storageType = UA_VARIANT_DATA_NODELETE;
+    } else {
+        UA_StatusCode retval = UA_DataValue_copy(value, dst);
+        if(retval != UA_STATUSCODE_GOOD) {
+            UA_Notification_delete(server, newNotification);
+            return retval;
+        }
     }
+    newNotification->mon = mon;
 
     /* Enqueue the notification */
     UA_assert(sub);
@@ -54362,9 +54884,25 @@ sampleCallbackWithValue(UA_Server *server, UA_Subscription *sub,
 
     /* <-- Point of no return --> */
 
-    /* Move/store the value for filter comparison and TransferSubscription */
+    /* Move/store the value for filter comparison and TransferSubscription.
+     * Scalar booleans and numerics are kept in the inline storage without an
+     * allocation. Other samples pointing into an external value are copied,
+     * since the application overwrites them with the next sample. */
+    UA_Boolean inlined = false;
     UA_DataValue_clear(&mon->lastValue);
-    mon->lastValue = *value;
+    if(value->hasValue && isInlineScalar(&value->value)) {
+        mon->lastValue = *value;
+        memcpy(&mon->lastValueData, value->value.data, value->value.type->memSize);
+        mon->lastValue.value.data = &mon->lastValueData;
+        mon->lastValue.value.storageType = UA_VARIANT_DATA_NODELETE;
+        inlined = true;
+    } else if(value->hasValue && value->value.storageType == UA_VARIANT_DATA_NODELETE) {
+        UA_StatusCode res = UA_DataValue_copy(value, &mon->lastValue);
+        if(res != UA_STATUSCODE_GOOD)
+            UA_DataValue_init(&mon->lastValue);
+    } else {
+        mon->lastValue = *value;
+    }
 
     /* Call the local callback if the MonitoredItem is not attached to a
      * subscription. Do this at the very end. Because the callback might delete
@@ -54381,6 +54919,11 @@ sampleCallbackWithValue(UA_Server *server, UA_Subscription *sub,
         UA_LOCK(&server->serviceMutex);
     }
 
+    /* The inlined sample was not moved, release it only now since the local
+     * callback above still reads it */
+    if(inlined)
+        UA_Variant_clear(&value->value);
+
     return UA_STATUSCODE_GOOD;
 }
 
@@ -65291,8 +65834,13 @@ UA_ServerConfig_addNetworkLayerTCP(UA_ServerConfig *conf, UA_UInt16 portNumber,
     if (recvBufferSize > 0)
         config.recvBufferSize = recvBufferSize;
 
+#ifdef UA_ENABLE_LWIP_NETWORKLAYER
+    conf->networkLayers[conf->networkLayersSize] =
+        UA_ServerNetworkLayerLWIP(config, portNumber, UA_LWIP_MAXCONNECTIONS);
+#else
     conf->networkLayers[conf->networkLayersSize] =
         UA_ServerNetworkLayerTCP(config, portNumber, 0);
+#endif
     if (!conf->networkLayers[conf->networkLayersSize].handle)
         return UA_STATUSCODE_BADOUTOFMEMORY;
     conf->networkLayersSize++;
@@ -66367,6 +66915,56 @@ connection_releaserecvbuffer(UA_Connection *connection,
     UA_ByteString_clear(buf);
 }
 
+/* Receive buffers are taken from a fixed pool when a server connection is
+ * opened and returned when it is removed. The buffers are allocated on first
+ * use and kept, so reading does not allocate in the steady state. Connections
+ * beyond the pool size fall back to allocating per read. */
+#ifndef UA_RECVBUFFER_POOL_SIZE
+# define UA_RECVBUFFER_POOL_SIZE 2
+#endif
+
+typedef struct {
+    UA_ByteString buffers[UA_RECVBUFFER_POOL_SIZE];
+    UA_Boolean used[UA_RECVBUFFER_POOL_SIZE];
+} RecvBufferPool;
+
+static UA_StatusCode
+RecvBufferPool_acquire(RecvBufferPool *pool, size_t length, UA_ByteString *buf) {
+    for(size_t i = 0; i < UA_RECVBUFFER_POOL_SIZE; i++) {
+        if(pool->used[i])
+            continue;
+        if(pool->buffers[i].length != length) {
+            UA_ByteString_clear(&pool->buffers[i]);
+            UA_StatusCode res = UA_ByteString_allocBuffer(&pool->buffers[i], length);
+            if(res != UA_STATUSCODE_GOOD)
+                return res;
+        }
+        pool->used[i] = true;
+        *buf = pool->buffers[i];
+        return UA_STATUSCODE_GOOD;
+    }
+    return UA_STATUSCODE_BADTCPNOTENOUGHRESOURCES;
+}
+
+static void
+RecvBufferPool_release(RecvBufferPool *pool, UA_ByteString *buf) {
+    for(size_t i = 0; i < UA_RECVBUFFER_POOL_SIZE; i++) {
+        if(pool->used[i] && pool->buffers[i].data == buf->data) {
+            pool->used[i] = false;
+            break;
+        }
+    }
+    *buf = UA_BYTESTRING_NULL;
+}
+
+static void
+RecvBufferPool_clear(RecvBufferPool *pool) {
+    for(size_t i = 0; i < UA_RECVBUFFER_POOL_SIZE; i++) {
+        UA_ByteString_clear(&pool->buffers[i]);
+        pool->used[i] = false;
+    }
+}
+
 static UA_StatusCode
 connection_write(UA_Connection *connection, UA_ByteString *buf) {
     if(connection->state == UA_CONNECTIONSTATE_CLOSED) {
@@ -66493,6 +67091,7 @@ connection_recv(UA_Connection *connection, UA_ByteString *response,
 typedef struct ConnectionEntry {
     UA_Connection connection;
     LIST_ENTRY(ConnectionEntry) pointers;
+    UA_ByteString recvBuffer; /* From the pool, or empty */
 } ConnectionEntry;
 
 typedef struct {
@@ -66503,6 +67102,7 @@ typedef struct {
     UA_UInt16 serverSocketsSize;
     LIST_HEAD(, ConnectionEntry) connections;
     UA_UInt16 connectionsSize;
+    RecvBufferPool recvBuffers;
 } ServerNetworkLayerTCP;
 
 static void
@@ -66528,6 +67128,7 @@ purgeFirstConnectionWithoutChannel(ServerNetworkLayerTCP *layer) {
             LIST_REMOVE(e, pointers);
             layer->connectionsSize--;
             UA_close(e->connection.sockfd);
+            RecvBufferPool_release(&layer->recvBuffers, &e->recvBuffer);
             e->connection.free(&e->connection);
             return true;
         }
@@ -66585,6 +67186,12 @@ ServerNetworkLayerTCP_add(UA_ServerNetworkLayer *nl, ServerNetworkLayerTCP *laye
         return UA_STATUSCODE_BADOUTOFMEMORY;
     }
 
+    /* Take a receive buffer from the pool. Without one, connection_recv
+     * allocates per read. */
+    e->recvBuffer = UA_BYTESTRING_NULL;
+    RecvBufferPool_acquire(&layer->recvBuffers, nl->localConnectionConfig.recvBufferSize,
+                           &e->recvBuffer);
+
     UA_Connection *c = &e->connection;
     memset(c, 0, sizeof(UA_Connection));
     c->sockfd = newsockfd;
@@ -66870,6 +67477,7 @@ ServerNetworkLayerTCP_listen(UA_ServerNetworkLayer *nl, UA_Server *server,
             LIST_REMOVE(e, pointers);
             layer->connectionsSize--;
             UA_close(e->connection.sockfd);
+            RecvBufferPool_release(&layer->recvBuffers, &e->recvBuffer);
             UA_Server_removeConnection(server, &e->connection);
             if(nl->statistics) {
                 nl->statistics->connectionTimeoutCount++;
@@ -66886,13 +67494,15 @@ ServerNetworkLayerTCP_listen(UA_ServerNetworkLayer *nl, UA_Server *server,
                     "Connection %i | Activity on the socket",
                     (int)(e->connection.sockfd));
 
-        UA_ByteString buf = UA_BYTESTRING_NULL;
+        /* Read into the pooled buffer if the connection has one */
+        UA_ByteString buf = e->recvBuffer;
         UA_StatusCode retval = connection_recv(&e->connection, &buf, 0);
 
         if(retval == UA_STATUSCODE_GOOD) {
             /* Process packets */
             UA_Server_processBinaryMessage(server, &e->connection, &buf);
-            connection_releaserecvbuffer(&e->connection, &buf);
+            if(!e->recvBuffer.data)
+                connection_releaserecvbuffer(&e->connection, &buf);
         } else if(retval == UA_STATUSCODE_BADCONNECTIONCLOSED) {
             /* The socket is shutdown but not closed */
             UA_LOG_INFO(layer->logger, UA_LOGCATEGORY_NETWORK,
@@ -66901,6 +67511,7 @@ ServerNetworkLayerTCP_listen(UA_ServerNetworkLayer *nl, UA_Server *server,
             LIST_REMOVE(e, pointers);
             layer->connectionsSize--;
             UA_close(e->connection.sockfd);
+            RecvBufferPool_release(&layer->recvBuffers, &e->recvBuffer);
             UA_Server_removeConnection(server, &e->connection);
             if(nl->statistics) {
                 nl->statistics->currentConnectionCount--;
@@ -66954,6 +67565,9 @@ ServerNetworkLayerTCP_clear(UA_ServerNetworkLayer *nl) {
         }
     }
 
+    /* Free the pooled receive buffers */
+    RecvBufferPool_clear(&layer->recvBuffers);
+
     /* Free the layer */
     UA_free(layer);
 }
@@ -67270,3 +67884,762 @@ UA_ClientConnectionTCP_init(UA_ConnectionConfig config, const UA_String endpoint
     /* Return connection with state UA_CONNECTIONSTATE_OPENING */
     return connection;
 }
+
+/**** amalgamated original file "/arch/freertosLWIP/network_lwip.c" ****/
+
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information.
+ */
+
+#if defined(UA_ARCHITECTURE_FREERTOSLWIP) && defined(UA_ENABLE_LWIP_NETWORKLAYER)
+
+#include <lwip/tcp.h>
+#include <FreeRTOS.h>
+#include <task.h>
+
+#if !LWIP_TCPIP_CORE_LOCKING
+# error "The lwIP network layer requires LWIP_TCPIP_CORE_LOCKING"
+#endif
+
+/* Task notification index the lwIP callbacks use to wake the server task.
+ * With UA_ENABLE_SERVER_WAKEUP it is the one the server loop sleeps on. */
+#ifndef UA_LWIP_NOTIFY_INDEX
+# ifdef UA_SERVER_NOTIFY_INDEX
+#  define UA_LWIP_NOTIFY_INDEX UA_SERVER_NOTIFY_INDEX
+# else
+#  define UA_LWIP_NOTIFY_INDEX 1
+# endif
+#endif
+
+#if defined(UA_ENABLE_SERVER_WAKEUP) && UA_LWIP_NOTIFY_INDEX != UA_SERVER_NOTIFY_INDEX
+# error "UA_LWIP_NOTIFY_INDEX has to be UA_SERVER_NOTIFY_INDEX"
+#endif
+
+#define LWIP_MAXBACKLOG     8
+#define LWIP_NOHELLOTIMEOUT 120000 /* timeout in ms before close the connection
+                                    * if server does not receive Hello Message */
+#define LWIP_SENDTIMEOUT    1000   /* max. ms to wait for space in the send
+                                    * buffer before checking the pcb again */
+
+/* Number of chunk buffers the layer keeps for getSendBuffer, shared by all
+ * connections. They are allocated on first use and recycled until the layer
+ * is cleared. The server task writes one chunk at a time, so few are ever in
+ * use together. When all of them are taken, getSendBuffer pushes back with
+ * BadTcpNotEnoughResources instead of allocating. */
+#ifndef UA_SENDBUFFER_RING_SIZE
+# define UA_SENDBUFFER_RING_SIZE 2
+#endif
+
+/****************************/
+/* Server NetworkLayer LWIP */
+/****************************/
+
+struct ServerNetworkLayerLWIP;
+
+typedef struct LWIPConnectionEntry {
+    UA_Connection connection;
+    LIST_ENTRY(LWIPConnectionEntry) pointers;
+    struct ServerNetworkLayerLWIP *layer;
+
+    /* Shared with the lwIP callbacks. Only accessed with the core lock held. */
+    struct tcp_pcb *pcb;       /* NULL once lwIP has freed the pcb */
+    struct pbuf *rx;           /* Received data not yet taken by the server */
+    UA_Boolean ready;          /* Linked into the ready list */
+    UA_Boolean remoteClosed;   /* FIN received or the pcb was aborted */
+    struct LWIPConnectionEntry *nextReady;
+
+    /* Owned by the server task */
+    UA_Boolean adopted;        /* Linked into the connection list */
+    struct pbuf *pending;      /* Data taken from rx for processing */
+    UA_ByteString recvBuffer;  /* From the pool, or empty */
+
+    /* A chunk whose beginning was handed over without gathering. Its
+     * remainder has to follow as is. */
+    UA_Byte chunkHeader[8];    /* Header bytes seen so far */
+    size_t chunkHeaderLength;  /* Between 1 and 7 while the header is split */
+    size_t chunkRemaining;     /* Bytes of the chunk still to come */
+    struct LWIPConnectionEntry *nextBatch;
+} LWIPConnectionEntry;
+
+typedef struct ServerNetworkLayerLWIP {
+    const UA_Logger *logger;
+    UA_UInt16 port;
+    UA_UInt16 maxConnections;
+    size_t sendBufferSize;
+    struct tcp_pcb *listenPcb;
+    TaskHandle_t task;
+    UA_Int32 nextConnectionId;
+
+    /* Connections with new data or a state change. Filled by the lwIP
+     * callbacks and drained by the server task, with the core lock held. */
+    LWIPConnectionEntry *readyHead;
+
+    /* Owned by the server task */
+    LIST_HEAD(, LWIPConnectionEntry) connections;
+    UA_UInt16 connectionsSize;
+    RecvBufferPool recvBuffers;
+
+    /* Send buffer ring */
+    UA_Byte *sendBuffers[UA_SENDBUFFER_RING_SIZE];
+    UA_Boolean sendBufferUsed[UA_SENDBUFFER_RING_SIZE];
+    size_t sendBufferNext;
+} ServerNetworkLayerLWIP;
+
+/* Queue a connection for the server task. The task is only notified when the
+ * list goes from empty to non-empty, so one wakeup covers the whole batch.
+ * Must be called with the core lock held. */
+static void
+ServerNetworkLayerLWIP_markReady(ServerNetworkLayerLWIP *layer,
+                                 LWIPConnectionEntry *e) {
+    if(e->ready)
+        return;
+    UA_Boolean wasEmpty = (layer->readyHead == NULL);
+    e->ready = true;
+    e->nextReady = layer->readyHead;
+    layer->readyHead = e;
+    if(wasEmpty && layer->task)
+        xTaskNotifyGiveIndexed(layer->task, UA_LWIP_NOTIFY_INDEX);
+}
+
+/* Must be called with the core lock held */
+static void
+ServerNetworkLayerLWIP_unmarkReady(ServerNetworkLayerLWIP *layer,
+                                   LWIPConnectionEntry *e) {
+    if(!e->ready)
+        return;
+    LWIPConnectionEntry **pp = &layer->readyHead;
+    while(*pp && *pp != e)
+        pp = &(*pp)->nextReady;
+    if(*pp)
+        *pp = e->nextReady;
+    e->ready = false;
+}
+
+/* Detach the callbacks and close the pcb. Must be called with the core lock
+ * held. */
+static void
+ServerNetworkLayerLWIP_closePcb(LWIPConnectionEntry *e) {
+    if(!e->pcb)
+        return;
+    tcp_arg(e->pcb, NULL);
+    tcp_recv(e->pcb, NULL);
+    tcp_sent(e->pcb, NULL);
+    tcp_err(e->pcb, NULL);
+    if(tcp_close(e->pcb) != ERR_OK)
+        tcp_abort(e->pcb);
+    e->pcb = NULL;
+}
+
+static err_t
+ServerNetworkLayerLWIP_recvCallback(void *arg, struct tcp_pcb *pcb,
+                                    struct pbuf *p, err_t err) {
+    LWIPConnectionEntry *e = (LWIPConnectionEntry*)arg;
+    if(!e) {
+        if(p)
+            pbuf_free(p);
+        return ERR_OK;
+    }
+
+    if(!p) {
+        e->remoteClosed = true;
+    } else if(!e->rx) {
+        e->rx = p;
+    } else {
+        pbuf_cat(e->rx, p);
+    }
+    ServerNetworkLayerLWIP_markReady(e->layer, e);
+    return ERR_OK;
+}
+
+static err_t
+ServerNetworkLayerLWIP_sentCallback(void *arg, struct tcp_pcb *pcb, u16_t len) {
+    LWIPConnectionEntry *e = (LWIPConnectionEntry*)arg;
+    /* Wake up a sender waiting for space in the send buffer */
+    if(e && e->layer->task)
+        xTaskNotifyGiveIndexed(e->layer->task, UA_LWIP_NOTIFY_INDEX);
+    return ERR_OK;
+}
+
+static void
+ServerNetworkLayerLWIP_errCallback(void *arg, err_t err) {
+    LWIPConnectionEntry *e = (LWIPConnectionEntry*)arg;
+    if(!e)
+        return;
+    /* The pcb is already freed by lwIP */
+    e->pcb = NULL;
+    e->remoteClosed = true;
+    ServerNetworkLayerLWIP_markReady(e->layer, e);
+}
+
+static UA_StatusCode
+ServerNetworkLayerLWIP_getSendBuffer(UA_Connection *connection,
+                                     size_t length, UA_ByteString *buf) {
+    ServerNetworkLayerLWIP *layer = ((LWIPConnectionEntry*)connection)->layer;
+    size_t bufferSize = layer->sendBufferSize;
+    UA_SecureChannel *channel = connection->channel;
+    if(length > bufferSize ||
+       (channel && channel->config.sendBufferSize < length))
+        return UA_STATUSCODE_BADCOMMUNICATIONERROR;
+
+    for(size_t i = 0; i < UA_SENDBUFFER_RING_SIZE; i++) {
+        size_t slot = (layer->sendBufferNext + i) % UA_SENDBUFFER_RING_SIZE;
+        if(layer->sendBufferUsed[slot])
+            continue;
+        if(!layer->sendBuffers[slot]) {
+            layer->sendBuffers[slot] = (UA_Byte*)UA_malloc(bufferSize);
+            if(!layer->sendBuffers[slot])
+                return UA_STATUSCODE_BADOUTOFMEMORY;
+        }
+        layer->sendBufferUsed[slot] = true;
+        layer->sendBufferNext = (slot + 1) % UA_SENDBUFFER_RING_SIZE;
+        buf->data = layer->sendBuffers[slot];
+        buf->length = length;
+        return UA_STATUSCODE_GOOD;
+    }
+
+    /* Every ring buffer is in use. Push back on the caller instead of
+     * allocating another one. */
+    return UA_STATUSCODE_BADTCPNOTENOUGHRESOURCES;
+}
+
+static void
+ServerNetworkLayerLWIP_releaseSendBuffer(UA_Connection *connection,
+                                         UA_ByteString *buf) {
+    ServerNetworkLayerLWIP *layer = ((LWIPConnectionEntry*)connection)->layer;
+    for(size_t i = 0; i < UA_SENDBUFFER_RING_SIZE; i++) {
+        if(layer->sendBufferUsed[i] && layer->sendBuffers[i] == buf->data) {
+            layer->sendBufferUsed[i] = false;
+            *buf = UA_BYTESTRING_NULL;
+            return;
+        }
+    }
+    UA_ByteString_clear(buf);
+}
+
+static UA_StatusCode
+ServerNetworkLayerLWIP_write(UA_Connection *connection, UA_ByteString *buf) {
+    LWIPConnectionEntry *e = (LWIPConnectionEntry*)connection;
+    if(connection->state == UA_CONNECTIONSTATE_CLOSED) {
+        ServerNetworkLayerLWIP_releaseSendBuffer(connection, buf);
+        return UA_STATUSCODE_BADCONNECTIONCLOSED;
+    }
+
+    size_t nWritten = 0;
+    while(nWritten < buf->length) {
+        err_t err = ERR_OK;
+        LOCK_TCPIP_CORE();
+        if(!e->pcb) {
+            UNLOCK_TCPIP_CORE();
+            connection->close(connection);
+            ServerNetworkLayerLWIP_releaseSendBuffer(connection, buf);
+            return UA_STATUSCODE_BADCONNECTIONCLOSED;
+        }
+        size_t n = buf->length - nWritten;
+        if(n > tcp_sndbuf(e->pcb))
+            n = tcp_sndbuf(e->pcb);
+        if(n > 0) {
+            err = tcp_write(e->pcb, buf->data + nWritten, (u16_t)n,
+                            TCP_WRITE_FLAG_COPY);
+            if(err == ERR_OK)
+                nWritten += n;
+        }
+        tcp_output(e->pcb);
+        UNLOCK_TCPIP_CORE();
+
+        if(err != ERR_OK && err != ERR_MEM) {
+            connection->close(connection);
+            ServerNetworkLayerLWIP_releaseSendBuffer(connection, buf);
+            return UA_STATUSCODE_BADCONNECTIONCLOSED;
+        }
+
+        /* Wait for acknowledged segments to free up the send buffer */
+        if(nWritten < buf->length)
+            ulTaskNotifyTakeIndexed(UA_LWIP_NOTIFY_INDEX, pdTRUE,
+                                    pdMS_TO_TICKS(LWIP_SENDTIMEOUT));
+    }
+
+    ServerNetworkLayerLWIP_releaseSendBuffer(connection, buf);
+    return UA_STATUSCODE_GOOD;
+}
+
+static void
+LWIPConnectionEntry_delete(LWIPConnectionEntry *e) {
+    UA_free(e);
+}
+
+static void
+ServerNetworkLayerLWIP_freeConnection(UA_Connection *connection) {
+    LWIPConnectionEntry_delete((LWIPConnectionEntry*)connection);
+}
+
+/* This only marks the connection. The pcb is closed and the connection freed
+ * when the server task picks it up from the ready list. */
+static void
+ServerNetworkLayerLWIP_close(UA_Connection *connection) {
+    if(connection->state == UA_CONNECTIONSTATE_CLOSED)
+        return;
+    connection->state = UA_CONNECTIONSTATE_CLOSED;
+    LWIPConnectionEntry *e = (LWIPConnectionEntry*)connection;
+    LOCK_TCPIP_CORE();
+    ServerNetworkLayerLWIP_markReady(e->layer, e);
+    UNLOCK_TCPIP_CORE();
+}
+
+static err_t
+ServerNetworkLayerLWIP_acceptCallback(void *arg, struct tcp_pcb *newpcb,
+                                      err_t err) {
+    ServerNetworkLayerLWIP *layer = (ServerNetworkLayerLWIP*)arg;
+    if(err != ERR_OK || !newpcb || !layer)
+        return ERR_VAL;
+
+    LWIPConnectionEntry *e = (LWIPConnectionEntry*)
+        UA_calloc(1, sizeof(LWIPConnectionEntry));
+    if(!e) {
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
+
+    e->layer = layer;
+    e->pcb = newpcb;
+
+    UA_Connection *c = &e->connection;
+    c->sockfd = layer->nextConnectionId++;
+    c->handle = layer;
+    c->send = ServerNetworkLayerLWIP_write;
+    c->close = ServerNetworkLayerLWIP_close;
+    c->free = ServerNetworkLayerLWIP_freeConnection;
+    c->getSendBuffer = ServerNetworkLayerLWIP_getSendBuffer;
+    c->releaseSendBuffer = ServerNetworkLayerLWIP_releaseSendBuffer;
+    c->releaseRecvBuffer = connection_releaserecvbuffer;
+    c->state = UA_CONNECTIONSTATE_OPENING;
+    c->openingDate = UA_DateTime_nowMonotonic();
+
+    /* Do not merge packets on the connection (disable Nagle's algorithm) */
+    tcp_nagle_disable(newpcb);
+    tcp_arg(newpcb, e);
+    tcp_recv(newpcb, ServerNetworkLayerLWIP_recvCallback);
+    tcp_sent(newpcb, ServerNetworkLayerLWIP_sentCallback);
+    tcp_err(newpcb, ServerNetworkLayerLWIP_errCallback);
+
+    /* The server task adds the connection to its list */
+    ServerNetworkLayerLWIP_markReady(layer, e);
+    return ERR_OK;
+}
+
+static UA_Boolean
+purgeFirstLWIPConnectionWithoutChannel(ServerNetworkLayerLWIP *layer) {
+    LWIPConnectionEntry *e;
+    LIST_FOREACH(e, &layer->connections, pointers) {
+        if(e->connection.channel == NULL &&
+           e->connection.state != UA_CONNECTIONSTATE_CLOSED) {
+            e->connection.close(&e->connection);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void
+ServerNetworkLayerLWIP_adopt(UA_ServerNetworkLayer *nl,
+                             ServerNetworkLayerLWIP *layer,
+                             LWIPConnectionEntry *e) {
+    e->adopted = true;
+
+    /* Unacknowledged data never exceeds the receive window, so a window-sized
+     * buffer holds every batch */
+    size_t recvBufferSize = nl->localConnectionConfig.recvBufferSize;
+    if(recvBufferSize > TCP_WND)
+        recvBufferSize = TCP_WND;
+    RecvBufferPool_acquire(&layer->recvBuffers, recvBufferSize, &e->recvBuffer);
+
+    if(layer->maxConnections && layer->connectionsSize >= layer->maxConnections &&
+       !purgeFirstLWIPConnectionWithoutChannel(layer)) {
+        UA_LOG_WARNING(layer->logger, UA_LOGCATEGORY_NETWORK,
+                       "Connection %i | Rejected, too many connections",
+                       (int)e->connection.sockfd);
+        e->connection.close(&e->connection);
+    } else {
+        UA_LOG_INFO(layer->logger, UA_LOGCATEGORY_NETWORK,
+                    "Connection %i | New connection over TCP",
+                    (int)e->connection.sockfd);
+    }
+
+    layer->connectionsSize++;
+    LIST_INSERT_HEAD(&layer->connections, e, pointers);
+    if(nl->statistics) {
+        nl->statistics->currentConnectionCount++;
+        nl->statistics->cumulatedConnectionCount++;
+    }
+}
+
+static void
+ServerNetworkLayerLWIP_remove(UA_ServerNetworkLayer *nl,
+                              ServerNetworkLayerLWIP *layer,
+                              UA_Server *server, LWIPConnectionEntry *e) {
+    UA_LOG_INFO(layer->logger, UA_LOGCATEGORY_NETWORK,
+                "Connection %i | Closed", (int)e->connection.sockfd);
+
+    LOCK_TCPIP_CORE();
+    ServerNetworkLayerLWIP_unmarkReady(layer, e);
+    ServerNetworkLayerLWIP_closePcb(e);
+    if(e->rx) {
+        pbuf_free(e->rx);
+        e->rx = NULL;
+    }
+    UNLOCK_TCPIP_CORE();
+
+    LIST_REMOVE(e, pointers);
+    layer->connectionsSize--;
+    if(nl->statistics)
+        nl->statistics->currentConnectionCount--;
+    RecvBufferPool_release(&layer->recvBuffers, &e->recvBuffer);
+    UA_Server_removeConnection(server, &e->connection);
+}
+
+static UA_StatusCode
+ServerNetworkLayerLWIP_start(UA_ServerNetworkLayer *nl, const UA_Logger *logger,
+                             const UA_String *customHostname) {
+    ServerNetworkLayerLWIP *layer = (ServerNetworkLayerLWIP *)nl->handle;
+    layer->logger = logger;
+
+    /* The callbacks wake the task that runs the server */
+    layer->task = xTaskGetCurrentTaskHandle();
+
+    LOCK_TCPIP_CORE();
+    struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if(!pcb) {
+        UNLOCK_TCPIP_CORE();
+        UA_LOG_WARNING(layer->logger, UA_LOGCATEGORY_NETWORK,
+                       "Error allocating the server pcb");
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+    ip_set_option(pcb, SOF_REUSEADDR);
+    if(tcp_bind(pcb, IP_ANY_TYPE, layer->port) != ERR_OK) {
+        tcp_close(pcb);
+        UNLOCK_TCPIP_CORE();
+        UA_LOG_WARNING(layer->logger, UA_LOGCATEGORY_NETWORK,
+                       "Error binding the server pcb to port %d", layer->port);
+        return UA_STATUSCODE_BADCOMMUNICATIONERROR;
+    }
+    layer->listenPcb = tcp_listen_with_backlog(pcb, LWIP_MAXBACKLOG);
+    if(!layer->listenPcb) {
+        tcp_close(pcb);
+        UNLOCK_TCPIP_CORE();
+        UA_LOG_WARNING(layer->logger, UA_LOGCATEGORY_NETWORK,
+                       "Error listening on the server pcb");
+        return UA_STATUSCODE_BADCOMMUNICATIONERROR;
+    }
+    tcp_arg(layer->listenPcb, layer);
+    tcp_accept(layer->listenPcb, ServerNetworkLayerLWIP_acceptCallback);
+    UNLOCK_TCPIP_CORE();
+
+    /* Get the discovery url from the hostname */
+    UA_String du = UA_STRING_NULL;
+    char discoveryUrlBuffer[256];
+    if(customHostname->length) {
+        du.length = (size_t)UA_snprintf(discoveryUrlBuffer, 255, "opc.tcp://%.*s:%d/",
+                                        (int)customHostname->length, customHostname->data,
+                                        layer->port);
+        du.data = (UA_Byte*)discoveryUrlBuffer;
+    } else {
+        char hostnameBuffer[256];
+        if(UA_gethostname(hostnameBuffer, 255) == 0) {
+            du.length = (size_t)UA_snprintf(discoveryUrlBuffer, 255, "opc.tcp://%s:%d/",
+                                            hostnameBuffer, layer->port);
+            du.data = (UA_Byte*)discoveryUrlBuffer;
+        } else {
+            UA_LOG_ERROR(layer->logger, UA_LOGCATEGORY_NETWORK, "Could not get the hostname");
+            return UA_STATUSCODE_BADINTERNALERROR;
+        }
+    }
+    UA_String_copy(&du, &nl->discoveryUrl);
+
+    UA_LOG_INFO(layer->logger, UA_LOGCATEGORY_NETWORK,
+                "lwIP network layer listening on %.*s",
+                (int)nl->discoveryUrl.length, nl->discoveryUrl.data);
+    return UA_STATUSCODE_GOOD;
+}
+
+/* Size of the chunk starting with the 8 byte header */
+static size_t
+LWIPChunk_length(const UA_Byte *header) {
+    return (size_t)header[4] | ((size_t)header[5] << 8) |
+        ((size_t)header[6] << 16) | ((size_t)header[7] << 24);
+}
+
+static void
+LWIPConnectionEntry_process(UA_Server *server, LWIPConnectionEntry *e,
+                            UA_Byte *data, size_t length) {
+    UA_ByteString buf = {length, data};
+    UA_Server_processBinaryMessage(server, &e->connection, &buf);
+}
+
+/* Hand a received chain to the server. Complete chunks within one segment are
+ * passed in place, consecutive ones in a single call. Only a chunk that spans
+ * segments is gathered into the pooled buffer, so that the SecureChannel does
+ * not persist it on the heap. A chunk that is not complete in the chain, or
+ * larger than the pooled buffer, is passed as is and the SecureChannel
+ * buffers it. Its remainder in the next chains then has to follow as is. */
+static void
+ServerNetworkLayerLWIP_processChain(UA_Server *server, LWIPConnectionEntry *e,
+                                    struct pbuf *p) {
+    const size_t total = p->tot_len;
+    struct pbuf *q = p;
+    size_t qStart = 0; /* Offset of q in the chain */
+    size_t offset = 0; /* First byte not yet handed over */
+    UA_Boolean malformed = false;
+
+    while(offset < total && e->connection.state != UA_CONNECTIONSTATE_CLOSED) {
+        while(offset >= qStart + q->len) {
+            qStart += q->len;
+            q = q->next;
+        }
+        UA_Byte *data = (UA_Byte*)q->payload + (offset - qStart);
+        size_t segRemaining = qStart + q->len - offset;
+
+        /* Complete a header that was split across chains */
+        if(e->chunkHeaderLength > 0) {
+            size_t n = 8 - e->chunkHeaderLength;
+            if(n > segRemaining)
+                n = segRemaining;
+            memcpy(&e->chunkHeader[e->chunkHeaderLength], data, n);
+            e->chunkHeaderLength += n;
+            if(e->chunkHeaderLength == 8) {
+                size_t chunkLength = LWIPChunk_length(e->chunkHeader);
+                e->chunkRemaining = (chunkLength > 8) ? chunkLength - 8 : 0;
+                e->chunkHeaderLength = 0;
+            }
+            LWIPConnectionEntry_process(server, e, data, n);
+            offset += n;
+            continue;
+        }
+
+        /* Continue a chunk that was passed as is. Malformed data is passed
+         * as is and left to the SecureChannel to reject. */
+        if(e->chunkRemaining > 0 || malformed) {
+            size_t n = segRemaining;
+            if(!malformed && n > e->chunkRemaining)
+                n = e->chunkRemaining;
+            if(!malformed)
+                e->chunkRemaining -= n;
+            LWIPConnectionEntry_process(server, e, data, n);
+            offset += n;
+            continue;
+        }
+
+        /* Pass the complete chunks within this segment in place */
+        size_t run = 0;
+        while(segRemaining - run >= 8) {
+            size_t chunkLength = LWIPChunk_length(&data[run]);
+            if(chunkLength < 8 || chunkLength > segRemaining - run)
+                break;
+            run += chunkLength;
+        }
+        if(run > 0) {
+            LWIPConnectionEntry_process(server, e, data, run);
+            offset += run;
+            continue;
+        }
+
+        /* Only a header split across segments remains in the chain */
+        if(total - offset < 8) {
+            e->chunkHeaderLength = segRemaining;
+            memcpy(e->chunkHeader, data, segRemaining);
+            LWIPConnectionEntry_process(server, e, data, segRemaining);
+            offset += segRemaining;
+            continue;
+        }
+
+        UA_Byte header[8];
+        pbuf_copy_partial(p, header, 8, (u16_t)offset);
+        size_t chunkLength = LWIPChunk_length(header);
+        if(chunkLength < 8) {
+            malformed = true;
+            continue;
+        }
+
+        /* The chunk spans segments, gather it */
+        if(chunkLength <= total - offset && chunkLength <= e->recvBuffer.length) {
+            pbuf_copy_partial(p, e->recvBuffer.data, (u16_t)chunkLength, (u16_t)offset);
+            LWIPConnectionEntry_process(server, e, e->recvBuffer.data, chunkLength);
+            offset += chunkLength;
+            continue;
+        }
+
+        /* Incomplete or too large, pass on what is in this segment */
+        e->chunkRemaining = chunkLength - segRemaining;
+        LWIPConnectionEntry_process(server, e, data, segRemaining);
+        offset += segRemaining;
+    }
+}
+
+static UA_StatusCode
+ServerNetworkLayerLWIP_listen(UA_ServerNetworkLayer *nl, UA_Server *server,
+                              UA_UInt16 timeout) {
+    ServerNetworkLayerLWIP *layer = (ServerNetworkLayerLWIP *)nl->handle;
+
+    /* Sleep until a callback reports activity. A notification given after
+     * the check stays pending, so no wakeup is lost. */
+    LOCK_TCPIP_CORE();
+    UA_Boolean idle = (layer->readyHead == NULL);
+    UNLOCK_TCPIP_CORE();
+    if(idle && timeout > 0)
+        ulTaskNotifyTakeIndexed(UA_LWIP_NOTIFY_INDEX, pdTRUE, pdMS_TO_TICKS(timeout));
+
+    /* Close connections that never sent a Hello */
+    LWIPConnectionEntry *e, *e_next;
+    UA_DateTime now = UA_DateTime_nowMonotonic();
+    LIST_FOREACH(e, &layer->connections, pointers) {
+        if((e->connection.state == UA_CONNECTIONSTATE_OPENING) &&
+           (now > (e->connection.openingDate + (LWIP_NOHELLOTIMEOUT * UA_DATETIME_MSEC)))) {
+            UA_LOG_INFO(layer->logger, UA_LOGCATEGORY_NETWORK,
+                        "Connection %i | Closed by the server (no Hello Message)",
+                        (int)(e->connection.sockfd));
+            e->connection.close(&e->connection);
+            if(nl->statistics)
+                nl->statistics->connectionTimeoutCount++;
+        }
+    }
+
+    /* Take the whole batch of ready connections at once. The callbacks may
+     * queue the same connections again while the batch is processed, so the
+     * batch is linked separately. */
+    LOCK_TCPIP_CORE();
+    LWIPConnectionEntry *batch = layer->readyHead;
+    layer->readyHead = NULL;
+    for(e = batch; e; e = e->nextReady) {
+        e->ready = false;
+        e->nextBatch = e->nextReady;
+        e->pending = e->rx;
+        e->rx = NULL;
+        if(e->remoteClosed && e->connection.state != UA_CONNECTIONSTATE_CLOSED)
+            e->connection.state = UA_CONNECTIONSTATE_CLOSED;
+    }
+    UNLOCK_TCPIP_CORE();
+
+    for(e = batch; e; e = e_next) {
+        e_next = e->nextBatch;
+        if(!e->adopted)
+            ServerNetworkLayerLWIP_adopt(nl, layer, e);
+
+        struct pbuf *p = e->pending;
+        if(p) {
+            e->pending = NULL;
+            ServerNetworkLayerLWIP_processChain(server, e, p);
+            LOCK_TCPIP_CORE();
+            if(e->pcb)
+                tcp_recved(e->pcb, p->tot_len);
+            pbuf_free(p);
+            UNLOCK_TCPIP_CORE();
+        }
+
+        if(e->connection.state == UA_CONNECTIONSTATE_CLOSED)
+            ServerNetworkLayerLWIP_remove(nl, layer, server, e);
+    }
+    return UA_STATUSCODE_GOOD;
+}
+
+static void
+ServerNetworkLayerLWIP_stop(UA_ServerNetworkLayer *nl, UA_Server *server) {
+    ServerNetworkLayerLWIP *layer = (ServerNetworkLayerLWIP *)nl->handle;
+    UA_LOG_INFO(layer->logger, UA_LOGCATEGORY_NETWORK,
+                "Shutting down the lwIP network layer");
+
+    /* Close the server pcb */
+    LOCK_TCPIP_CORE();
+    if(layer->listenPcb) {
+        tcp_arg(layer->listenPcb, NULL);
+        tcp_accept(layer->listenPcb, NULL);
+        tcp_close(layer->listenPcb);
+        layer->listenPcb = NULL;
+    }
+    UNLOCK_TCPIP_CORE();
+
+    /* Adopt connections accepted in the meantime and close all of them */
+    ServerNetworkLayerLWIP_listen(nl, server, 0);
+    LWIPConnectionEntry *e;
+    LIST_FOREACH(e, &layer->connections, pointers)
+        ServerNetworkLayerLWIP_close(&e->connection);
+
+    /* Pick up the closed connections and free them */
+    ServerNetworkLayerLWIP_listen(nl, server, 0);
+    layer->task = NULL;
+}
+
+/* run only when the server is stopped */
+static void
+ServerNetworkLayerLWIP_clear(UA_ServerNetworkLayer *nl) {
+    ServerNetworkLayerLWIP *layer = (ServerNetworkLayerLWIP *)nl->handle;
+    UA_String_clear(&nl->discoveryUrl);
+
+    /* Hard-close and remove remaining connections. The server is no longer
+     * running. So this is safe. */
+    LOCK_TCPIP_CORE();
+    if(layer->listenPcb) {
+        tcp_arg(layer->listenPcb, NULL);
+        tcp_accept(layer->listenPcb, NULL);
+        tcp_close(layer->listenPcb);
+        layer->listenPcb = NULL;
+    }
+    LWIPConnectionEntry *e, *e_tmp;
+    for(e = layer->readyHead; e; e = e_tmp) {
+        e_tmp = e->nextReady;
+        e->ready = false;
+        if(e->adopted)
+            continue;
+        ServerNetworkLayerLWIP_closePcb(e);
+        if(e->rx)
+            pbuf_free(e->rx);
+        LWIPConnectionEntry_delete(e);
+    }
+    layer->readyHead = NULL;
+    LIST_FOREACH_SAFE(e, &layer->connections, pointers, e_tmp) {
+        LIST_REMOVE(e, pointers);
+        layer->connectionsSize--;
+        ServerNetworkLayerLWIP_closePcb(e);
+        if(e->rx)
+            pbuf_free(e->rx);
+        LWIPConnectionEntry_delete(e);
+        if(nl->statistics) {
+            nl->statistics->currentConnectionCount--;
+        }
+    }
+    UNLOCK_TCPIP_CORE();
+
+    /* Free the pooled receive and send buffers */
+    RecvBufferPool_clear(&layer->recvBuffers);
+    for(size_t i = 0; i < UA_SENDBUFFER_RING_SIZE; i++)
+        UA_free(layer->sendBuffers[i]);
+
+    /* Free the layer */
+    UA_free(layer);
+}
+
+UA_ServerNetworkLayer
+UA_ServerNetworkLayerLWIP(UA_ConnectionConfig config, UA_UInt16 port,
+                          UA_UInt16 maxConnections) {
+    UA_ServerNetworkLayer nl;
+    memset(&nl, 0, sizeof(UA_ServerNetworkLayer));
+    nl.clear = ServerNetworkLayerLWIP_clear;
+    nl.localConnectionConfig = config;
+    nl.start = ServerNetworkLayerLWIP_start;
+    nl.listen = ServerNetworkLayerLWIP_listen;
+    nl.stop = ServerNetworkLayerLWIP_stop;
+    nl.handle = NULL;
+
+    ServerNetworkLayerLWIP *layer = (ServerNetworkLayerLWIP*)
+        UA_calloc(1, sizeof(ServerNetworkLayerLWIP));
+    if(!layer)
+        return nl;
+    nl.handle = layer;
+
+    /* Every connection holds receive state and lwIP memory, never accept an
+     * unbounded number of them */
+    layer->port = port;
+    layer->maxConnections = (maxConnections > 0) ? maxConnections : UA_LWIP_MAXCONNECTIONS;
+    layer->sendBufferSize = config.sendBufferSize;
+
+    return nl;
+}
+
+#endif /* UA_ARCHITECTURE_FREERTOSLWIP && UA_ENABLE_LWIP_NETWORKLAYER */
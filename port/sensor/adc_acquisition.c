@@ -0,0 +1,345 @@
+/**
+ * Copyright (c) 2022 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Includes
+ * ----------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+
+#include "pico/stdlib.h"
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include "adc_filter.h"
+#include "adc_acquisition.h"
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Macros
+ * ----------------------------------------------------------------------------------------------------
+ */
+#define ADC_ACQ_CHANNEL_COUNT (((ADC_ACQ_INPUT_MASK >> 0) & 1) + ((ADC_ACQ_INPUT_MASK >> 1) & 1) + \
+                               ((ADC_ACQ_INPUT_MASK >> 2) & 1) + ((ADC_ACQ_INPUT_MASK >> 3) & 1) + \
+                               ((ADC_ACQ_INPUT_MASK >> 4) & 1))
+
+#if ADC_ACQ_CHANNEL_COUNT == 0
+#error "ADC_ACQ_INPUT_MASK selects no input"
+#endif
+
+/* A dropped block then leaves the round robin aligned with the start of the next one */
+#if (ADC_ACQ_BLOCK_SAMPLES % ADC_ACQ_CHANNEL_COUNT) != 0
+#error "ADC_ACQ_BLOCK_SAMPLES must be a multiple of the number of inputs"
+#endif
+
+#define ADC_ACQ_CLOCK_HZ 48000000.0f          // ADC clock, from the USB PLL
+#define ADC_ACQ_MAX_SAMPLE_RATE_HZ 500000.0f  // 96 ADC clock cycles per conversion
+#define ADC_ACQ_FIRST_GPIO 26                 // inputs 0 to 3 are GPIO 26 to 29
+
+/* Period after which a stalled DMA stream is reported */
+#define ADC_ACQ_TIMEOUT_MS 1000
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Variables
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* DMA */
+static int dma_block[2];
+static uint16_t adc_blocks[2][ADC_ACQ_BLOCK_SAMPLES];
+static volatile uint32_t blocks_completed = 0; // written by the DMA interrupt only
+static TaskHandle_t acquisition_task = NULL;
+
+/* Inputs */
+static uint8_t channel_input[ADC_ACQ_CHANNEL_COUNT]; // round robin index to ADC input
+static sensor_ring_t input_rings[ADC_ACQ_INPUT_COUNT];
+static float input_gain[ADC_ACQ_INPUT_COUNT] = {1.0f, 1.0f, 1.0f, 1.0f, 1.0f};
+static float input_offset[ADC_ACQ_INPUT_COUNT] = {0.0f};
+
+/* Listener */
+static adc_acquisition_listener_t publish_listener = NULL;
+static void *publish_context = NULL;
+
+/* Filter */
+static adc_filter_t adc_filter;
+
+/* Statistics */
+static adc_acquisition_stats_t acquisition_stats;
+static TickType_t start_tick;
+static TickType_t last_block_tick;
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+static void adc_acquisition_irq_handler(void)
+{
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    bool completed = false;
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (dma_channel_get_irq1_status(dma_block[i]))
+        {
+            dma_channel_acknowledge_irq1(dma_block[i]);
+
+            // The other channel is already running, rearm this one for its next turn
+            dma_channel_set_write_addr(dma_block[i], adc_blocks[i], false);
+            blocks_completed++;
+            completed = true;
+        }
+    }
+
+    if (completed && acquisition_task != NULL)
+    {
+        vTaskNotifyGiveFromISR(acquisition_task, &xHigherPriorityTaskWoken);
+    }
+
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
+static void adc_acquisition_start(void)
+{
+    float sample_rate = (float)ADC_ACQ_SAMPLE_RATE_HZ;
+    uint32_t channel = 0;
+
+    if (sample_rate > ADC_ACQ_MAX_SAMPLE_RATE_HZ)
+    {
+        sample_rate = ADC_ACQ_MAX_SAMPLE_RATE_HZ;
+    }
+
+    for (uint32_t input = 0; input < ADC_ACQ_INPUT_COUNT; input++)
+    {
+        if (!(ADC_ACQ_INPUT_MASK & (1u << input)))
+        {
+            continue;
+        }
+
+        channel_input[channel++] = input;
+
+        if (input == ADC_ACQ_TEMP_SENSOR_INPUT)
+        {
+            adc_set_temp_sensor_enabled(true);
+        }
+        else
+        {
+            adc_gpio_init(ADC_ACQ_FIRST_GPIO + input);
+        }
+    }
+
+    adc_filter_initialize(&adc_filter, ADC_ACQ_CHANNEL_COUNT, ADC_ACQ_DECIMATION, ADC_ACQ_FILTER_ALPHA);
+
+    acquisition_stats.sample_rate = sample_rate;
+    acquisition_stats.output_rate = sample_rate / ADC_ACQ_CHANNEL_COUNT / ADC_ACQ_DECIMATION;
+
+    // Free-running round robin, every conversion is pushed to the FIFO with its error flag
+    adc_run(false);
+    adc_select_input(channel_input[0]);
+    adc_set_round_robin(ADC_ACQ_INPUT_MASK);
+    adc_set_clkdiv(ADC_ACQ_CLOCK_HZ / sample_rate - 1.0f);
+    adc_fifo_setup(true, true, 1, true, false);
+    adc_fifo_drain();
+
+    // Two blocks chained to each other, the ADC never waits for the CPU
+    for (int i = 0; i < 2; i++)
+    {
+        dma_block[i] = dma_claim_unused_channel(true);
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        dma_channel_config config = dma_channel_get_default_config(dma_block[i]);
+
+        channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
+        channel_config_set_read_increment(&config, false);
+        channel_config_set_write_increment(&config, true);
+        channel_config_set_dreq(&config, DREQ_ADC);
+        channel_config_set_chain_to(&config, dma_block[1 - i]);
+
+        dma_channel_configure(dma_block[i], &config, adc_blocks[i], &adc_hw->fifo, ADC_ACQ_BLOCK_SAMPLES, false);
+        dma_channel_set_irq1_enabled(dma_block[i], true);
+    }
+
+    // DMA_IRQ_0 belongs to the WIZnet SPI driver
+    irq_add_shared_handler(DMA_IRQ_1, adc_acquisition_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_1, true);
+
+    start_tick = xTaskGetTickCount();
+    last_block_tick = start_tick;
+
+    dma_channel_start(dma_block[0]);
+    adc_run(true);
+}
+
+/* A FIFO overflow drops conversions, after which the samples no longer match their round robin
+ * position. Stops the stream and restarts it at the first input with empty blocks. */
+static void adc_acquisition_resync(void)
+{
+    uint32_t mask = (1u << dma_block[0]) | (1u << dma_block[1]);
+
+    adc_run(false);
+    while (!(adc_hw->cs & ADC_CS_READY_BITS))
+    {
+        tight_loop_contents();
+    }
+
+    // An aborted channel can still raise its interrupt, so mask both and abort them together
+    for (int i = 0; i < 2; i++)
+    {
+        dma_channel_set_irq1_enabled(dma_block[i], false);
+    }
+    dma_hw->abort = mask;
+    while (dma_hw->abort & mask)
+    {
+        tight_loop_contents();
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        dma_channel_acknowledge_irq1(dma_block[i]);
+        dma_channel_set_write_addr(dma_block[i], adc_blocks[i], false);
+        dma_channel_set_trans_count(dma_block[i], ADC_ACQ_BLOCK_SAMPLES, false);
+        dma_channel_set_irq1_enabled(dma_block[i], true);
+    }
+
+    // OVER and UNDER are write-1-to-clear; write back the control bits with only OVER set
+    adc_fifo_drain();
+    adc_hw->fcs = (adc_hw->fcs & ~(ADC_FCS_OVER_BITS | ADC_FCS_UNDER_BITS)) | ADC_FCS_OVER_BITS;
+
+    adc_select_input(channel_input[0]);
+    adc_filter_resync(&adc_filter);
+
+    dma_channel_start(dma_block[0]);
+    adc_run(true);
+}
+
+static void adc_acquisition_publish(uint32_t updated)
+{
+    const float conversion_factor = ADC_ACQ_VREF / (4096 - 1);
+    TickType_t tick = xTaskGetTickCount();
+    adc_acquisition_listener_t listener;
+    uint32_t inputs = 0;
+
+    for (uint32_t channel = 0; channel < ADC_ACQ_CHANNEL_COUNT; channel++)
+    {
+        if (updated & (1u << channel))
+        {
+            uint32_t input = channel_input[channel];
+            float volts = adc_filter_output(&adc_filter, channel) * conversion_factor;
+
+            sensor_ring_publish(&input_rings[input], volts * input_gain[input] + input_offset[input], tick, SENSOR_STATUS_GOOD);
+            inputs |= 1u << input;
+        }
+    }
+
+    listener = __atomic_load_n(&publish_listener, __ATOMIC_ACQUIRE);
+    if (listener != NULL)
+    {
+        listener(inputs, publish_context);
+    }
+}
+
+void adc_acquisition_set_conversion(uint32_t input, float gain, float offset)
+{
+    if (input < ADC_ACQ_INPUT_COUNT)
+    {
+        input_gain[input] = gain;
+        input_offset[input] = offset;
+    }
+}
+
+void adc_acquisition_set_listener(adc_acquisition_listener_t listener, void *context)
+{
+    __atomic_store_n(&publish_listener, NULL, __ATOMIC_RELEASE);
+    publish_context = context;
+    __atomic_store_n(&publish_listener, listener, __ATOMIC_RELEASE);
+}
+
+void adc_acquisition_task(void *argument)
+{
+    uint32_t processed = 0;
+
+    for (uint32_t input = 0; input < ADC_ACQ_INPUT_COUNT; input++)
+    {
+        sensor_ring_initialize(&input_rings[input]);
+    }
+
+    acquisition_task = xTaskGetCurrentTaskHandle();
+    adc_acquisition_start();
+
+    while (1)
+    {
+        if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ADC_ACQ_TIMEOUT_MS)) == 0)
+        {
+            printf("[ADC]\t\tNo DMA block in %d ms\n", ADC_ACQ_TIMEOUT_MS);
+            continue;
+        }
+
+        // The pending blocks are misaligned after an overflow, drop them with the stream
+        if (adc_hw->fcs & ADC_FCS_OVER_BITS)
+        {
+            adc_acquisition_resync();
+            acquisition_stats.overruns++;
+            processed = blocks_completed;
+            continue;
+        }
+
+        uint32_t completed = blocks_completed;
+
+        // Only the block completed last is intact once the other one is being written again
+        if (completed - processed > 1)
+        {
+            acquisition_stats.overruns += completed - processed - 1;
+            processed = completed - 1;
+        }
+
+        while (processed != completed)
+        {
+            uint32_t updated = adc_filter_process(&adc_filter, adc_blocks[processed & 1], ADC_ACQ_BLOCK_SAMPLES);
+
+            processed++;
+
+            if (updated)
+            {
+                adc_acquisition_publish(updated);
+            }
+        }
+
+        acquisition_stats.blocks = processed;
+        last_block_tick = xTaskGetTickCount();
+    }
+}
+
+const sensor_ring_t *adc_acquisition_ring(uint32_t input)
+{
+    if (input >= ADC_ACQ_INPUT_COUNT || !(ADC_ACQ_INPUT_MASK & (1u << input)))
+    {
+        return NULL;
+    }
+
+    return &input_rings[input];
+}
+
+void adc_acquisition_get_stats(adc_acquisition_stats_t *stats)
+{
+    TickType_t elapsed = last_block_tick - start_tick;
+
+    *stats = acquisition_stats;
+    stats->errors = 0;
+
+    for (uint32_t channel = 0; channel < ADC_ACQ_CHANNEL_COUNT; channel++)
+    {
+        stats->errors += adc_filter.errors[channel];
+    }
+
+    stats->measured_rate = (elapsed > 0) ? ((float)stats->blocks * ADC_ACQ_BLOCK_SAMPLES * configTICK_RATE_HZ / elapsed) : 0.0f;
+}
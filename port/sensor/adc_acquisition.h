@@ -0,0 +1,122 @@
+/**
+ * Copyright (c) 2022 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _ADC_ACQUISITION_H_
+#define _ADC_ACQUISITION_H_
+
+#include <stdint.h>
+
+#include "sensor_ring.h"
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Macros
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* ADC inputs */
+#define ADC_ACQ_INPUT_COUNT 5
+#define ADC_ACQ_TEMP_SENSOR_INPUT 4 // internal temperature sensor
+
+/* Inputs in the round robin, bit n selects input n */
+#ifndef ADC_ACQ_INPUT_MASK
+#define ADC_ACQ_INPUT_MASK 0x1F
+#endif
+
+/* Conversions per second over all inputs, at most 500 kS/s */
+#ifndef ADC_ACQ_SAMPLE_RATE_HZ
+#define ADC_ACQ_SAMPLE_RATE_HZ 10000
+#endif
+
+/* Samples per DMA block, two blocks are filled alternately */
+#ifndef ADC_ACQ_BLOCK_SAMPLES
+#define ADC_ACQ_BLOCK_SAMPLES 500
+#endif
+
+/* Conversions per input averaged into one output */
+#ifndef ADC_ACQ_DECIMATION
+#define ADC_ACQ_DECIMATION 200
+#endif
+
+/* Low-pass coefficient applied to the averaged outputs, 1 disables it */
+#ifndef ADC_ACQ_FILTER_ALPHA
+#define ADC_ACQ_FILTER_ALPHA 0.25f
+#endif
+
+/* Reference voltage */
+#define ADC_ACQ_VREF 3.3f
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Variables
+ * ----------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    float sample_rate;      // configured conversions per second over all inputs
+    float measured_rate;    // conversions per second actually delivered by DMA
+    float output_rate;      // filtered outputs per second per input
+    uint32_t blocks;        // DMA blocks delivered
+    uint32_t errors;        // conversions dropped for the error flag
+    uint32_t overruns;      // blocks overwritten before they were processed, or FIFO overflows
+} adc_acquisition_stats_t;
+
+/* Called from ADC_Task after new outputs are published, inputs is a bit mask of the inputs */
+typedef void (*adc_acquisition_listener_t)(uint32_t inputs, void *context);
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+/*! \brief Set the conversion of an input
+ *  \ingroup adc_acquisition
+ *
+ *  Outputs of the input are published as volts * gain + offset. Inputs publish volts by default.
+ *  Must be called before the acquisition task starts.
+ *
+ *  \param input ADC input
+ *  \param gain scale applied to the voltage
+ *  \param offset offset added after scaling
+ */
+void adc_acquisition_set_conversion(uint32_t input, float gain, float offset);
+
+/*! \brief Set the publish listener
+ *  \ingroup adc_acquisition
+ *
+ *  The listener runs on ADC_Task and must not block. Replaces any previous listener.
+ *
+ *  \param listener the listener, NULL to remove it
+ *  \param context passed to the listener
+ */
+void adc_acquisition_set_listener(adc_acquisition_listener_t listener, void *context);
+
+/*! \brief Acquisition task
+ *  \ingroup adc_acquisition
+ *
+ *  Starts the ADC in free-running round robin mode over ADC_ACQ_INPUT_MASK, streams the
+ *  conversions into two DMA blocks and publishes the decimated outputs of every input.
+ *  The DMA interrupt is taken on the core the task first runs on.
+ *
+ *  \param argument unused
+ */
+void adc_acquisition_task(void *argument);
+
+/*! \brief Get the output ring of an input
+ *  \ingroup adc_acquisition
+ *
+ *  \param input ADC input
+ *  \return the ring, NULL if the input is not sampled
+ */
+const sensor_ring_t *adc_acquisition_ring(uint32_t input);
+
+/*! \brief Get acquisition statistics
+ *  \ingroup adc_acquisition
+ *
+ *  \param stats filled with the current statistics
+ */
+void adc_acquisition_get_stats(adc_acquisition_stats_t *stats);
+
+#endif /* _ADC_ACQUISITION_H_ */
@@ -0,0 +1,95 @@
+/**
+ * Copyright (c) 2022 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Includes
+ * ----------------------------------------------------------------------------------------------------
+ */
+#include <string.h>
+
+#include "adc_filter.h"
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+void adc_filter_initialize(adc_filter_t *filter, uint32_t channels, uint32_t decimation, float alpha)
+{
+    memset(filter, 0, sizeof(adc_filter_t));
+
+    filter->channels = (channels > ADC_FILTER_MAX_CHANNELS) ? ADC_FILTER_MAX_CHANNELS : channels;
+    filter->decimation = (decimation == 0) ? 1 : decimation;
+    filter->alpha = (alpha <= 0.0f || alpha > 1.0f) ? 1.0f : alpha;
+}
+
+uint32_t adc_filter_process(adc_filter_t *filter, const uint16_t *samples, uint32_t count)
+{
+    uint32_t updated = 0;
+    uint32_t channel = filter->position;
+
+    if (filter->channels == 0)
+    {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint16_t sample = samples[i];
+
+        if (sample & ADC_FILTER_ERROR_BIT)
+        {
+            filter->errors[channel]++;
+        }
+        else
+        {
+            filter->sums[channel] += sample;
+
+            if (++filter->counts[channel] == filter->decimation)
+            {
+                float average = (float)filter->sums[channel] / (float)filter->decimation;
+
+                if (filter->primed[channel])
+                {
+                    filter->outputs[channel] += filter->alpha * (average - filter->outputs[channel]);
+                }
+                else
+                {
+                    filter->outputs[channel] = average;
+                    filter->primed[channel] = true;
+                }
+
+                filter->sums[channel] = 0;
+                filter->counts[channel] = 0;
+                updated |= 1u << channel;
+            }
+        }
+
+        if (++channel == filter->channels)
+        {
+            channel = 0;
+        }
+    }
+
+    filter->position = channel;
+
+    return updated;
+}
+
+void adc_filter_resync(adc_filter_t *filter)
+{
+    filter->position = 0;
+
+    memset(filter->sums, 0, sizeof(filter->sums));
+    memset(filter->counts, 0, sizeof(filter->counts));
+    memset(filter->primed, 0, sizeof(filter->primed));
+}
+
+float adc_filter_output(const adc_filter_t *filter, uint32_t channel)
+{
+    return (channel < filter->channels) ? filter->outputs[channel] : 0.0f;
+}
@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2022 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _ADC_FILTER_H_
+#define _ADC_FILTER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Macros
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Round robin channels, the RP2040 ADC has 5 inputs */
+#define ADC_FILTER_MAX_CHANNELS 5
+
+/* Conversion error flag in a FIFO sample */
+#define ADC_FILTER_ERROR_BIT (1u << 15)
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Variables
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Splits a round-robin sample stream into channels, averages every `decimation` samples of a
+ * channel into one output and smooths the outputs with a first order low-pass. Has no hardware
+ * dependencies. */
+typedef struct
+{
+    uint32_t channels;   // channels in the round robin
+    uint32_t decimation; // good samples averaged into one output
+    float alpha;         // low-pass coefficient, 1 passes the averages unchanged
+    uint32_t position;   // round robin position of the next sample
+
+    uint32_t sums[ADC_FILTER_MAX_CHANNELS];
+    uint32_t counts[ADC_FILTER_MAX_CHANNELS];
+    uint32_t errors[ADC_FILTER_MAX_CHANNELS]; // samples dropped for the error flag
+    float outputs[ADC_FILTER_MAX_CHANNELS];   // in ADC counts
+    bool primed[ADC_FILTER_MAX_CHANNELS];
+} adc_filter_t;
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+/*! \brief Initialize a decimation filter
+ *  \ingroup adc_filter
+ *
+ *  \param filter the filter
+ *  \param channels channels in the round robin, at most ADC_FILTER_MAX_CHANNELS
+ *  \param decimation samples per channel averaged into one output
+ *  \param alpha low-pass coefficient in (0, 1]
+ */
+void adc_filter_initialize(adc_filter_t *filter, uint32_t channels, uint32_t decimation, float alpha);
+
+/*! \brief Feed raw samples
+ *  \ingroup adc_filter
+ *
+ *  Samples must be in round robin order and continue where the previous block ended.
+ *
+ *  \param filter the filter
+ *  \param samples raw 12 bit samples with ADC_FILTER_ERROR_BIT
+ *  \param count number of samples
+ *  \return bit mask of the channels that produced a new output
+ */
+uint32_t adc_filter_process(adc_filter_t *filter, const uint16_t *samples, uint32_t count);
+
+/*! \brief Restart the round robin at its first channel
+ *  \ingroup adc_filter
+ *
+ *  For a stream that lost samples. Partial averages are dropped and the next output of every
+ *  channel replaces the previous one instead of being smoothed into it.
+ *
+ *  \param filter the filter
+ */
+void adc_filter_resync(adc_filter_t *filter);
+
+/*! \brief Get the latest output of a channel
+ *  \ingroup adc_filter
+ *
+ *  \param filter the filter
+ *  \param channel round robin index of the channel
+ *  \return the filtered value in ADC counts
+ */
+float adc_filter_output(const adc_filter_t *filter, uint32_t channel);
+
+#endif /* _ADC_FILTER_H_ */
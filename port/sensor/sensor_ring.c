@@ -0,0 +1,89 @@
+/**
+ * Copyright (c) 2022 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Includes
+ * ----------------------------------------------------------------------------------------------------
+ */
+#include <string.h>
+
+#include "sensor_ring.h"
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Macros
+ * ----------------------------------------------------------------------------------------------------
+ */
+#define SENSOR_RING_MASK (SENSOR_RING_SIZE - 1)
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+void sensor_ring_initialize(sensor_ring_t *ring)
+{
+    memset(ring->samples, 0, sizeof(ring->samples));
+    __atomic_store_n(&ring->head, 0, __ATOMIC_RELEASE);
+}
+
+void sensor_ring_publish(sensor_ring_t *ring, float value, uint32_t tick, uint32_t status)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    sensor_sample_t *sample = &ring->samples[head & SENSOR_RING_MASK];
+
+    // Keep the previous head update ahead of overwriting the slot
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    sample->value = value;
+    sample->tick = tick;
+    sample->status = status;
+
+    // Make the sample visible before the new head
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t sensor_ring_count(const sensor_ring_t *ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+bool sensor_ring_latest(const sensor_ring_t *ring, sensor_sample_t *sample)
+{
+    return sensor_ring_window(ring, sample, 1) == 1;
+}
+
+uint32_t sensor_ring_window(const sensor_ring_t *ring, sensor_sample_t *samples, uint32_t count)
+{
+    uint32_t head;
+    uint32_t n;
+
+    if (count > SENSOR_RING_SIZE - 1)
+    {
+        count = SENSOR_RING_SIZE - 1;
+    }
+
+    while (1)
+    {
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        n = (head < count) ? head : count;
+
+        for (uint32_t i = 0; i < n; i++)
+        {
+            samples[i] = ring->samples[(head - n + i) & SENSOR_RING_MASK];
+        }
+
+        // Read the samples before checking the head again
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        // The oldest copied slot is reused once the producer starts on sample head - n + SENSOR_RING_SIZE
+        if (__atomic_load_n(&ring->head, __ATOMIC_RELAXED) - head < SENSOR_RING_SIZE - n)
+        {
+            return n;
+        }
+    }
+}
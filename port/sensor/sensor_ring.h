@@ -0,0 +1,110 @@
+/**
+ * Copyright (c) 2022 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _SENSOR_RING_H_
+#define _SENSOR_RING_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Macros
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Ring size, must be a power of two */
+#ifndef SENSOR_RING_SIZE
+#define SENSOR_RING_SIZE 16
+#endif
+
+#if (SENSOR_RING_SIZE & (SENSOR_RING_SIZE - 1)) != 0
+#error "SENSOR_RING_SIZE must be a power of two"
+#endif
+
+/* Sample status */
+#define SENSOR_STATUS_GOOD 0
+#define SENSOR_STATUS_FAULT 1
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Variables
+ * ----------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    float value;
+    uint32_t tick;   // monotonic time of the sample, in scheduler ticks
+    uint32_t status; // SENSOR_STATUS_x
+} sensor_sample_t;
+
+/* One acquisition task publishes, any number of readers look at the latest
+ * samples without taking them out. Neither side locks. */
+typedef struct
+{
+    sensor_sample_t samples[SENSOR_RING_SIZE];
+    volatile uint32_t head; // number of samples published so far
+} sensor_ring_t;
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+/*! \brief Initialize a sample ring
+ *  \ingroup sensor_ring
+ *
+ *  \param ring the ring
+ */
+void sensor_ring_initialize(sensor_ring_t *ring);
+
+/*! \brief Publish a sample
+ *  \ingroup sensor_ring
+ *
+ *  Must only be called from the single producer of the ring.
+ *
+ *  \param ring the ring
+ *  \param value the sample value
+ *  \param tick monotonic time of the sample
+ *  \param status SENSOR_STATUS_x
+ */
+void sensor_ring_publish(sensor_ring_t *ring, float value, uint32_t tick, uint32_t status);
+
+/*! \brief Get the number of samples published so far
+ *  \ingroup sensor_ring
+ *
+ *  Lets a reader tell whether a new sample has arrived since it last looked.
+ *
+ *  \param ring the ring
+ *  \return the publish count, wraps around
+ */
+uint32_t sensor_ring_count(const sensor_ring_t *ring);
+
+/*! \brief Read the latest sample
+ *  \ingroup sensor_ring
+ *
+ *  Safe against a producer running concurrently on the other core. A sample the producer
+ *  overwrites while it is being copied is detected and the copy is retried.
+ *
+ *  \param ring the ring
+ *  \param sample receives the latest sample
+ *  \return false if nothing has been published yet
+ */
+bool sensor_ring_latest(const sensor_ring_t *ring, sensor_sample_t *sample);
+
+/*! \brief Read the most recent samples
+ *  \ingroup sensor_ring
+ *
+ *  Copies up to count samples, oldest first, with the same consistency as sensor_ring_latest().
+ *  At most SENSOR_RING_SIZE - 1 samples are returned.
+ *
+ *  \param ring the ring
+ *  \param samples receives the samples
+ *  \param count capacity of samples
+ *  \return number of samples copied
+ */
+uint32_t sensor_ring_window(const sensor_ring_t *ring, sensor_sample_t *samples, uint32_t count);
+
+#endif /* _SENSOR_RING_H_ */